@@ -0,0 +1,278 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "robot_config.h"
+#include "servo_control.h"
+#include "gripper_model.h"
+#include "robot_hal_posix.h"
+
+/*
+ * IK benchmark. Sweeps an x / y / z / angle / width grid through the four robot_set_* ik paths with
+ * robot_validate, the same solver the commands run without moving the arm, and the gripper width lookup.
+ * Every solution is driven back through robot_forward, the distance to the target is the round trip error.
+ * Results are written as one JSON object.
+ *
+ *   ik_bench [-g XYZ_STEPS] [-a ANGLE_STEPS] [-w WIDTH_STEPS] [-s IK_SELECT] [-o FILE]
+ */
+void app_main(void);
+
+#define BENCH_BATCH (64)     // targets per robot_validate call, as the binary VALIDATE
+
+// grid bounds, cm and degree, wider than the workspace so the rejection path is measured too
+#define BENCH_X_MIN (-20.0)
+#define BENCH_X_MAX (20.0)
+#define BENCH_Y_MIN (-5.0)
+#define BENCH_Y_MAX (30.0)
+#define BENCH_Z_MIN (-5.0)
+#define BENCH_Z_MAX (25.0)
+#define BENCH_ANGLE_MIN (0.0)
+#define BENCH_ANGLE_MAX (90.0)
+#define BENCH_WIDTH_MIN (0.5)
+#define BENCH_WIDTH_MAX (6.5)
+
+typedef struct {
+    int xyz_steps;
+    int angle_steps;
+    int width_steps;
+    int ik_select;
+    const char *output;
+} bench_option_t;
+
+typedef struct {
+    const char *name;
+    robot_target_kind_t kind;
+    long point;
+    long solved;
+    double time_us;
+    double error_sum;     // cm
+    double error_sq;
+    double error_max;
+} bench_path_t;
+
+static bench_option_t option = {
+    .xyz_steps = 24,
+    .angle_steps = 7,
+    .width_steps = 6,
+    .ik_select = ROBOT_IK_SELECT_FIRST,
+    .output = NULL,
+};
+
+static bench_path_t path[] = {
+    {.name = "SETPOS", .kind = ROBOT_TARGET_POSITION},
+    {.name = "SETPOSNARG", .kind = ROBOT_TARGET_POSITION_ANGLE},
+    {.name = "SETWIDPOS", .kind = ROBOT_TARGET_WIDTH_POSITION},
+    {.name = "SETPOSANGWID", .kind = ROBOT_TARGET_POSITION_ANGLE_WIDTH},
+};
+
+static double bench_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double bench_axis(double min, double max, int steps, int i)
+{
+    return steps > 1 ? min + (max - min) * i / (steps - 1) : (min + max) / 2;
+}
+
+// time one batch, then check every solution against forward kinematics
+static void bench_batch(bench_path_t *p, const robot_target_t *target, int num)
+{
+    robot_validate_result_t result[BENCH_BATCH];
+    double begin = bench_now_us();
+    robot_validate(target, num, result);
+    p->time_us += bench_now_us() - begin;
+    p->point += num;
+    for (int n = 0; n < num; n++) {
+        if (result[n].reachable == false) {
+            continue;
+        }
+        p->solved++;
+        double x, y, z;
+        if (robot_forward(result[n].duty, result[n].cripper_len, &x, &y, &z) != ESP_OK) {
+            continue;
+        }
+        double error = sqrt((x - target[n].x) * (x - target[n].x) + (y - target[n].y) * (y - target[n].y) +
+                            (z - target[n].z) * (z - target[n].z));
+        p->error_sum += error;
+        p->error_sq += error * error;
+        if (error > p->error_max) {
+            p->error_max = error;
+        }
+    }
+}
+
+static void bench_path(bench_path_t *p)
+{
+    bool use_angle = p->kind == ROBOT_TARGET_POSITION_ANGLE || p->kind == ROBOT_TARGET_POSITION_ANGLE_WIDTH;
+    bool use_width = p->kind == ROBOT_TARGET_WIDTH_POSITION || p->kind == ROBOT_TARGET_POSITION_ANGLE_WIDTH;
+    int angle_steps = use_angle ? option.angle_steps : 1;
+    int width_steps = use_width ? option.width_steps : 1;
+    robot_target_t target[BENCH_BATCH];
+    int num = 0;
+    for (int ix = 0; ix < option.xyz_steps; ix++) {
+        for (int iy = 0; iy < option.xyz_steps; iy++) {
+            for (int iz = 0; iz < option.xyz_steps; iz++) {
+                for (int ia = 0; ia < angle_steps; ia++) {
+                    for (int iw = 0; iw < width_steps; iw++) {
+                        target[num] = (robot_target_t){
+                            .kind = p->kind,
+                            .x = bench_axis(BENCH_X_MIN, BENCH_X_MAX, option.xyz_steps, ix),
+                            .y = bench_axis(BENCH_Y_MIN, BENCH_Y_MAX, option.xyz_steps, iy),
+                            .z = bench_axis(BENCH_Z_MIN, BENCH_Z_MAX, option.xyz_steps, iz),
+                            .angle = use_angle ? bench_axis(BENCH_ANGLE_MIN, BENCH_ANGLE_MAX, angle_steps, ia) : 0,
+                            .width = use_width ? bench_axis(BENCH_WIDTH_MIN, BENCH_WIDTH_MAX, width_steps, iw) : 0,
+                        };
+                        if (++num == BENCH_BATCH) {
+                            bench_batch(p, target, num);
+                            num = 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (num > 0) {
+        bench_batch(p, target, num);
+    }
+}
+
+// gripper width lookup on a factory table model with the lut size servo_control.c uses
+static void bench_gripper(FILE *out)
+{
+    gripper_model_config_t config = {.storage = NULL, .key = NULL, .lut_size = 64};
+    gripper_model_handle_t model = gripper_model_init(&config);
+    if (model == NULL) {
+        fprintf(out, "  \"gripper\": null\n");
+        return;
+    }
+    int steps = option.xyz_steps * option.xyz_steps * option.width_steps;
+    long solved = 0;
+    bool monotone = true;
+    int last_duty = 0;
+    double last_len = 0;
+    double begin = bench_now_us();
+    for (int i = 0; i < steps; i++) {
+        int duty;
+        double len;
+        if (gripper_model_lookup(model, bench_axis(BENCH_WIDTH_MIN, BENCH_WIDTH_MAX, steps, i), &duty, &len) !=
+            ESP_OK) {
+            continue;
+        }
+        // the table is monotone, so is every sweep through it
+        if (solved > 0 && (duty - last_duty) * (double)(len - last_len) < 0) {
+            monotone = false;
+        }
+        solved++;
+        last_duty = duty;
+        last_len = len;
+    }
+    double time_us = bench_now_us() - begin;
+    gripper_model_destroy(model);
+    fprintf(out,
+            "  \"gripper\": {\"points\": %d, \"solved\": %ld, \"rejection_rate\": %.4f, \"solves_per_s\": %.0f, "
+            "\"monotone\": %s}\n",
+            steps, solved, 1.0 - (double)solved / steps, time_us > 0 ? steps / time_us * 1e6 : 0,
+            monotone ? "true" : "false");
+}
+
+static void bench_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-g XYZ_STEPS] [-a ANGLE_STEPS] [-w WIDTH_STEPS] [-s IK_SELECT] [-o FILE]\n"
+            "  -g  grid points along x, y and z, default %d\n"
+            "  -a  grid points along the wrist angle, default %d\n"
+            "  -w  grid points along the gripper width, default %d\n"
+            "  -s  ik selection, 0 first, 1 min distance, 2 min time, default %d\n"
+            "  -o  write the JSON to FILE instead of stdout\n",
+            name, option.xyz_steps, option.angle_steps, option.width_steps, option.ik_select);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "g:a:w:s:o:")) != -1) {
+        switch (opt) {
+        case 'g':
+            option.xyz_steps = atoi(optarg);
+            break;
+        case 'a':
+            option.angle_steps = atoi(optarg);
+            break;
+        case 'w':
+            option.width_steps = atoi(optarg);
+            break;
+        case 's':
+            option.ik_select = atoi(optarg);
+            break;
+        case 'o':
+            option.output = optarg;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || option.xyz_steps < 1 || option.angle_steps < 1 || option.width_steps < 1) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+    FILE *out = option.output ? fopen(option.output, "w") : stdout;
+    if (out == NULL) {
+        perror(option.output);
+        return 2;
+    }
+
+    // every rejected target writes a deferred error log, keep its formatting off the measurement
+    setenv("ROBOT_HOST_LOG", "0", 0);
+    // the arm never moves, the tick stays still
+    robot_hal_posix_tick_manual();
+    app_main();
+    robot_ik_select_t select;
+    robot_get_ik_select(&select);
+    select.mode = option.ik_select;
+    if (robot_set_ik_select(&select) != ESP_OK) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out,
+            "  \"grid\": {\"x\": [%.1f, %.1f], \"y\": [%.1f, %.1f], \"z\": [%.1f, %.1f], \"angle\": [%.1f, %.1f], "
+            "\"width\": [%.1f, %.1f], \"xyz_steps\": %d, \"angle_steps\": %d, \"width_steps\": %d},\n",
+            BENCH_X_MIN, BENCH_X_MAX, BENCH_Y_MIN, BENCH_Y_MAX, BENCH_Z_MIN, BENCH_Z_MAX, BENCH_ANGLE_MIN,
+            BENCH_ANGLE_MAX, BENCH_WIDTH_MIN, BENCH_WIDTH_MAX, option.xyz_steps, option.angle_steps,
+            option.width_steps);
+    fprintf(out, "  \"ik_select\": %d,\n", option.ik_select);
+    fprintf(out, "  \"paths\": [\n");
+    int path_num = sizeof(path) / sizeof(path[0]);
+    for (int i = 0; i < path_num; i++) {
+        bench_path_t *p = &path[i];
+        bench_path(p);
+        double solved = p->solved > 0 ? p->solved : 1;
+        fprintf(out,
+                "    {\"name\": \"%s\", \"kind\": %d, \"points\": %ld, \"solved\": %ld, \"rejection_rate\": %.4f, "
+                "\"solves_per_s\": %.0f, \"us_per_point\": %.3f, \"fk_error_cm\": {\"mean\": %.5f, \"rms\": %.5f, "
+                "\"max\": %.5f}}%s\n",
+                p->name, p->kind, p->point, p->solved, 1.0 - (double)p->solved / p->point,
+                p->time_us > 0 ? p->point / p->time_us * 1e6 : 0, p->time_us / p->point, p->error_sum / solved,
+                sqrt(p->error_sq / solved), p->error_max, i + 1 < path_num ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    bench_gripper(out);
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
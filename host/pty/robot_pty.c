@@ -0,0 +1,116 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "robot_hal_posix.h"
+
+/*
+ * Firmware stand-in on a pseudo terminal. uart_task and the motion core run unchanged over robot_hal_posix.c
+ * in real time, the command port is the master side of a pty. A pc controller opens the slave like the usb
+ * serial of the arm and speaks the same 0x7E / 0x7F framed protocol, at full speed or paced like a uart.
+ *
+ *   robot_pty [-l LINK] [-b BAUD]
+ */
+void app_main(void);
+
+static const char *link_path = NULL;
+
+static void pty_exit(int sig)
+{
+    if (link_path) {
+        unlink(link_path);
+    }
+    _exit(0);
+}
+
+// slave side raw, the line discipline must not touch 0x7E / 0x7D / 0x7F frames
+static int pty_open(char *slave_name, size_t size)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 || ptsname_r(master, slave_name, size) != 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+    // held open so the master never reads EIO while no controller is attached
+    int slave = open(slave_name, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        perror(slave_name);
+        return -1;
+    }
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    return master;
+}
+
+static void pty_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-l LINK] [-b BAUD]\n"
+            "  -l  symlink LINK to the slave, removed at exit\n"
+            "  -b  pace the port like a uart of BAUD, 0 uses the firmware rate;"
+            " without -b the port runs at full speed\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, baud = -1;
+    while ((opt = getopt(argc, argv, "l:b:")) != -1) {
+        switch (opt) {
+        case 'l':
+            link_path = optarg;
+            break;
+        case 'b':
+            baud = atoi(optarg);
+            break;
+        default:
+            pty_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || baud < -1) {
+        pty_usage(argv[0]);
+        return 2;
+    }
+
+    char slave_name[64];
+    int master = pty_open(slave_name, sizeof(slave_name));
+    if (master < 0) {
+        return 1;
+    }
+    if (link_path) {
+        unlink(link_path);
+        if (symlink(slave_name, link_path) != 0) {
+            perror(link_path);
+            return 1;
+        }
+    }
+    signal(SIGINT, pty_exit);
+    signal(SIGTERM, pty_exit);
+
+    robot_hal_posix_serial_use(master);
+    if (baud >= 0) {
+        robot_hal_posix_serial_pace(baud);
+    }
+    printf("%s\n", link_path ? link_path : slave_name);
+    fflush(stdout);
+    app_main();
+    while (1) {
+        pause();
+    }
+    return 0;
+}
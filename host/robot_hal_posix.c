@@ -0,0 +1,421 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "robot_hal_posix.h"
+
+static const char *TAG = "ROBOT_HAL";
+
+#define KV_KEY_SIZE (16)     // nvs key and namespace limit, 15 characters
+#define TICK_DONE_TIMEOUT_MS (1000)
+
+typedef struct hal_kv_blob {
+    char key[KV_KEY_SIZE];
+    void *data;
+    size_t len;
+    struct hal_kv_blob *next;
+} hal_kv_blob_t;
+
+struct robot_hal_kv {
+    char namespace[KV_KEY_SIZE];
+    hal_kv_blob_t *blob;
+    struct robot_hal_kv *next;
+};
+
+struct robot_hal_lock {
+    pthread_mutex_t mutex;
+};
+
+static volatile uint32_t hal_pwm_duty[ROBOT_HAL_PWM_CHANNEL_MAX];
+
+static robot_hal_tick_cb_t hal_tick_cb = NULL;
+static void *hal_tick_arg = NULL;
+static uint32_t hal_tick_period_ms = 0;
+static bool hal_tick_running = false;
+static uint64_t hal_tick_epoch = 0;     // bumped by start and pause, a sleeping tick thread restarts its period
+static bool hal_tick_manual = false;     // no tick thread, robot_hal_posix_tick_step fires the callback
+static uint64_t hal_tick_fired = 0;
+static uint64_t hal_tick_done = 0;
+static pthread_mutex_t hal_tick_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hal_tick_cond = PTHREAD_COND_INITIALIZER;
+
+static int hal_serial_fd[2] = {-1, -1};     // [0] firmware side, [1] peer
+static int hal_serial_baud = 0;             // given to robot_hal_serial_init
+static int hal_serial_pace_baud = -1;       // -1 full speed, 0 hal_serial_baud
+static int64_t hal_serial_rx_free_us = 0;     // line busy until, CLOCK_MONOTONIC
+static int64_t hal_serial_tx_free_us = 0;
+static pthread_mutex_t hal_serial_tx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// namespaces are never freed, the store lives as long as the process
+static struct robot_hal_kv *hal_kv_list = NULL;
+static pthread_mutex_t hal_kv_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * PWM
+ */
+esp_err_t robot_hal_pwm_init(const int *pin, int num)
+{
+    if (num > ROBOT_HAL_PWM_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset((void *)hal_pwm_duty, 0, sizeof(hal_pwm_duty));
+    return ESP_OK;
+}
+
+esp_err_t robot_hal_pwm_write(int channel, uint32_t duty_us)
+{
+    if (channel < 0 || channel >= ROBOT_HAL_PWM_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    hal_pwm_duty[channel] = duty_us;
+    return ESP_OK;
+}
+
+uint32_t robot_hal_posix_pwm_read(int channel) { return hal_pwm_duty[channel]; }
+
+/*
+ * TICK
+ */
+static void hal_timespec_add_ms(struct timespec *ts, uint32_t ms)
+{
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    ts->tv_sec += ms / 1000 + ts->tv_nsec / 1000000000L;
+    ts->tv_nsec %= 1000000000L;
+}
+
+// stands in for the timer isr, calls cb every period while running
+static void *hal_tick_thread(void *arg)
+{
+    struct timespec next;
+    pthread_mutex_lock(&hal_tick_lock);
+    while (1) {
+        while (hal_tick_running == false) {
+            pthread_cond_wait(&hal_tick_cond, &hal_tick_lock);
+        }
+        uint64_t epoch = hal_tick_epoch;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        hal_timespec_add_ms(&next, hal_tick_period_ms);
+        while (hal_tick_running && epoch == hal_tick_epoch) {
+            if (pthread_cond_timedwait(&hal_tick_cond, &hal_tick_lock, &next) != ETIMEDOUT) {
+                continue;
+            }
+            pthread_mutex_unlock(&hal_tick_lock);
+            hal_tick_cb(hal_tick_arg);
+            pthread_mutex_lock(&hal_tick_lock);
+            // auto reload, a late callback does not shift the following ones
+            hal_timespec_add_ms(&next, hal_tick_period_ms);
+        }
+    }
+    return NULL;
+}
+
+esp_err_t robot_hal_tick_init(uint32_t period_ms, robot_hal_tick_cb_t cb, void *arg)
+{
+    if (hal_tick_cb != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    hal_tick_cb = cb;
+    hal_tick_arg = arg;
+    hal_tick_period_ms = period_ms;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hal_tick_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (hal_tick_manual) {
+        return ESP_OK;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, hal_tick_thread, NULL) != 0) {
+        ESP_LOGE(TAG, "Error create tick thread");
+        return ESP_FAIL;
+    }
+    pthread_detach(thread);
+    return ESP_OK;
+}
+
+void robot_hal_tick_start(void)
+{
+    pthread_mutex_lock(&hal_tick_lock);
+    hal_tick_running = true;
+    hal_tick_epoch++;
+    pthread_cond_broadcast(&hal_tick_cond);
+    pthread_mutex_unlock(&hal_tick_lock);
+}
+
+void robot_hal_tick_pause(void)
+{
+    pthread_mutex_lock(&hal_tick_lock);
+    hal_tick_running = false;
+    hal_tick_epoch++;
+    pthread_cond_broadcast(&hal_tick_cond);
+    pthread_mutex_unlock(&hal_tick_lock);
+}
+
+void robot_hal_tick_done(void)
+{
+    pthread_mutex_lock(&hal_tick_lock);
+    hal_tick_done++;
+    pthread_cond_broadcast(&hal_tick_cond);
+    pthread_mutex_unlock(&hal_tick_lock);
+}
+
+void robot_hal_posix_tick_manual(void)
+{
+    hal_tick_manual = true;
+    esp_timer_host_virtual();
+}
+
+bool robot_hal_posix_tick_running(void)
+{
+    pthread_mutex_lock(&hal_tick_lock);
+    bool running = hal_tick_running;
+    pthread_mutex_unlock(&hal_tick_lock);
+    return running;
+}
+
+bool robot_hal_posix_tick_step(void)
+{
+    pthread_mutex_lock(&hal_tick_lock);
+    if (hal_tick_manual == false || hal_tick_running == false) {
+        pthread_mutex_unlock(&hal_tick_lock);
+        return false;
+    }
+    uint64_t fired = ++hal_tick_fired;
+    pthread_mutex_unlock(&hal_tick_lock);
+
+    esp_timer_host_advance((int64_t)hal_tick_period_ms * 1000);
+    hal_tick_cb(hal_tick_arg);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    hal_timespec_add_ms(&deadline, TICK_DONE_TIMEOUT_MS);
+    pthread_mutex_lock(&hal_tick_lock);
+    while (hal_tick_done < fired) {
+        if (pthread_cond_timedwait(&hal_tick_cond, &hal_tick_lock, &deadline) == ETIMEDOUT) {
+            // the event was lost on a full queue, do not wait for it again
+            ESP_LOGW(TAG, "tick %llu not done in %d ms", (unsigned long long)fired, TICK_DONE_TIMEOUT_MS);
+            hal_tick_done = fired;
+        }
+    }
+    pthread_mutex_unlock(&hal_tick_lock);
+    return true;
+}
+
+/*
+ * SERIAL
+ */
+// a stream socket pair unless robot_hal_posix_serial_use gave the port, baud rate only sets the pacing
+esp_err_t robot_hal_serial_init(int baud_rate, int rx_buf_size)
+{
+    if (hal_serial_baud != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    hal_serial_baud = baud_rate;
+    if (hal_serial_fd[0] >= 0) {
+        return ESP_OK;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, hal_serial_fd) != 0) {
+        ESP_LOGE(TAG, "Error socketpair: %d", errno);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int robot_hal_posix_serial_peer(void) { return hal_serial_fd[1]; }
+
+void robot_hal_posix_serial_use(int fd) { hal_serial_fd[0] = fd; }
+
+void robot_hal_posix_serial_pace(int baud) { hal_serial_pace_baud = baud; }
+
+// hold the caller until len more bytes went over the line, 10 bits a byte
+static void hal_serial_pace(int64_t *free_us, int len)
+{
+    int baud = hal_serial_pace_baud == 0 ? hal_serial_baud : hal_serial_pace_baud;
+    if (baud <= 0 || len <= 0) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (*free_us < now) {
+        *free_us = now;
+    }
+    *free_us += (int64_t)len * 10 * 1000000 / baud;
+    ts.tv_sec = *free_us / 1000000;
+    ts.tv_nsec = (*free_us % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+int robot_hal_serial_read(uint8_t *buff, int len, uint32_t timeout_ms)
+{
+    struct pollfd pfd = {.fd = hal_serial_fd[0], .events = POLLIN};
+    if (poll(&pfd, 1, (int)timeout_ms) <= 0) {
+        return 0;
+    }
+    ssize_t n = read(hal_serial_fd[0], buff, len);
+    if (n <= 0) {
+        return 0;
+    }
+    hal_serial_pace(&hal_serial_rx_free_us, n);
+    return (int)n;
+}
+
+int robot_hal_serial_available(void)
+{
+    int pending = 0;
+    if (ioctl(hal_serial_fd[0], FIONREAD, &pending) != 0) {
+        return 0;
+    }
+    return pending;
+}
+
+int robot_hal_serial_write(const uint8_t *buff, int len)
+{
+    int written = 0;
+    pthread_mutex_lock(&hal_serial_tx_lock);
+    while (written < len) {
+        ssize_t n = write(hal_serial_fd[0], buff + written, len - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            written = -1;
+            break;
+        }
+        written += n;
+    }
+    if (written > 0) {
+        hal_serial_pace(&hal_serial_tx_free_us, written);
+    }
+    pthread_mutex_unlock(&hal_serial_tx_lock);
+    return written;
+}
+
+/*
+ * KEY VALUE, in memory, lost at exit
+ */
+esp_err_t robot_hal_kv_init(void) { return ESP_OK; }
+
+esp_err_t robot_hal_kv_open(const char *namespace, robot_hal_kv_t *kv)
+{
+    if (strlen(namespace) >= KV_KEY_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&hal_kv_lock);
+    struct robot_hal_kv *item = hal_kv_list;
+    while (item && strcmp(item->namespace, namespace) != 0) {
+        item = item->next;
+    }
+    if (item == NULL) {
+        item = calloc(1, sizeof(struct robot_hal_kv));
+        if (item == NULL) {
+            pthread_mutex_unlock(&hal_kv_lock);
+            return ESP_ERR_NO_MEM;
+        }
+        strcpy(item->namespace, namespace);
+        item->next = hal_kv_list;
+        hal_kv_list = item;
+    }
+    pthread_mutex_unlock(&hal_kv_lock);
+    *kv = item;
+    return ESP_OK;
+}
+
+void robot_hal_kv_close(robot_hal_kv_t kv) {}
+
+// must be called with hal_kv_lock
+static hal_kv_blob_t *hal_kv_find(robot_hal_kv_t kv, const char *key)
+{
+    hal_kv_blob_t *blob = kv->blob;
+    while (blob && strcmp(blob->key, key) != 0) {
+        blob = blob->next;
+    }
+    return blob;
+}
+
+esp_err_t robot_hal_kv_get(robot_hal_kv_t kv, const char *key, void *buff, size_t *len)
+{
+    esp_err_t err = ESP_OK;
+    pthread_mutex_lock(&hal_kv_lock);
+    hal_kv_blob_t *blob = hal_kv_find(kv, key);
+    if (blob == NULL) {
+        err = ESP_ERR_NOT_FOUND;
+    } else if (blob->len > *len) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        memcpy(buff, blob->data, blob->len);
+        *len = blob->len;
+    }
+    pthread_mutex_unlock(&hal_kv_lock);
+    return err;
+}
+
+esp_err_t robot_hal_kv_set(robot_hal_kv_t kv, const char *key, const void *buff, size_t len)
+{
+    if (strlen(key) >= KV_KEY_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    void *data = malloc(len ? len : 1);
+    if (data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(data, buff, len);
+    pthread_mutex_lock(&hal_kv_lock);
+    hal_kv_blob_t *blob = hal_kv_find(kv, key);
+    if (blob == NULL) {
+        blob = calloc(1, sizeof(hal_kv_blob_t));
+        if (blob == NULL) {
+            pthread_mutex_unlock(&hal_kv_lock);
+            free(data);
+            return ESP_ERR_NO_MEM;
+        }
+        strcpy(blob->key, key);
+        blob->next = kv->blob;
+        kv->blob = blob;
+    }
+    free(blob->data);
+    blob->data = data;
+    blob->len = len;
+    pthread_mutex_unlock(&hal_kv_lock);
+    return ESP_OK;
+}
+
+esp_err_t robot_hal_kv_commit(robot_hal_kv_t kv) { return ESP_OK; }
+
+/*
+ * LOCK
+ */
+robot_hal_lock_t robot_hal_lock_create(void)
+{
+    robot_hal_lock_t lock = calloc(1, sizeof(struct robot_hal_lock));
+    if (lock) {
+        pthread_mutex_init(&lock->mutex, NULL);
+    }
+    return lock;
+}
+
+void robot_hal_lock(robot_hal_lock_t lock) { pthread_mutex_lock(&lock->mutex); }
+
+void robot_hal_unlock(robot_hal_lock_t lock) { pthread_mutex_unlock(&lock->mutex); }
+
+void robot_hal_lock_destroy(robot_hal_lock_t lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    free(lock);
+}
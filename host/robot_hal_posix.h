@@ -0,0 +1,65 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_HAL_POSIX_H_
+#define _ROBOT_HAL_POSIX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "robot_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Host side of the posix backend, for test binaries and tools
+ */
+
+/**
+ * Last pulse width written to channel, 0 before the first write
+ */
+uint32_t robot_hal_posix_pwm_read(int channel);
+
+/**
+ * The other end of the command port. Bytes written to it are what the firmware reads,
+ * its responses can be read from it. Valid after robot_hal_serial_init
+ */
+int robot_hal_posix_serial_peer(void);
+
+/**
+ * Use fd as the command port instead of a socket pair, call before app_main. The peer stays -1
+ */
+void robot_hal_posix_serial_use(int fd);
+
+/**
+ * Hold every read and write of the command port for the time a uart line of baud takes to carry it,
+ * 10 bits a byte. 0 is the rate robot_hal_serial_init is given. Full speed unless called
+ */
+void robot_hal_posix_serial_pace(int baud);
+
+/**
+ * Drive the tick by hand on a virtual esp_timer clock, call before app_main.
+ * No tick thread is started, time only moves by robot_hal_posix_tick_step and esp_timer_host_advance
+ */
+void robot_hal_posix_tick_manual(void);
+
+/**
+ * The motion task has the tick started
+ */
+bool robot_hal_posix_tick_running(void);
+
+/**
+ * Manual tick only. Advance the clock one period, fire the callback and wait until the motion task
+ * reports the tick done. Return false without firing when the tick is paused
+ */
+bool robot_hal_posix_tick_step(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _HOST_ESP_ATTR_H_
+#define _HOST_ESP_ATTR_H_
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+
+#endif
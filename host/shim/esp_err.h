@@ -0,0 +1,51 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _HOST_ESP_ERR_H_
+#define _HOST_ESP_ERR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int32_t esp_err_t;
+
+// same values as esp-idf
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10A
+
+#define ESP_ERR_FLASH_BASE 0x10010
+#define ESP_ERR_FLASH_NOT_INITIALISED (ESP_ERR_FLASH_BASE + 3)
+
+#define ESP_ERROR_CHECK(x)                                                                                       \
+    do {                                                                                                         \
+        esp_err_t __err_rc = (x);                                                                                \
+        if (__err_rc != ESP_OK) {                                                                                \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: 0x%x at %s:%d: %s\n", __err_rc, __FILE__, __LINE__, #x);    \
+            abort();                                                                                             \
+        }                                                                                                        \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/crc.h"
+
+#define LOG_TAG_MAX (16)
+
+typedef struct {
+    const char *tag;
+    esp_log_level_t level;
+} log_tag_level_t;
+
+static log_tag_level_t log_tag[LOG_TAG_MAX];
+static int log_tag_num = 0;
+static esp_log_level_t log_default = ESP_LOG_INFO;
+static int log_cap = -1;     // ROBOT_HOST_LOG, -1 => not read yet
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t timer_start_us = 0;
+static int64_t timer_virtual_us = -1;     // >= 0 once the clock is virtual
+
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// esp_timer counts from boot, here from process start
+__attribute__((constructor)) static void timer_start(void) { timer_start_us = monotonic_us(); }
+
+int64_t esp_timer_get_time(void)
+{
+    if (timer_virtual_us >= 0) {
+        return __atomic_load_n(&timer_virtual_us, __ATOMIC_ACQUIRE);
+    }
+    return monotonic_us() - timer_start_us;
+}
+
+void esp_timer_host_virtual(void)
+{
+    if (timer_virtual_us < 0) {
+        __atomic_store_n(&timer_virtual_us, monotonic_us() - timer_start_us, __ATOMIC_RELEASE);
+    }
+}
+
+void esp_timer_host_advance(int64_t us) { __atomic_add_fetch(&timer_virtual_us, us, __ATOMIC_ACQ_REL); }
+
+uint32_t esp_log_timestamp(void) { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    pthread_mutex_lock(&log_lock);
+    if (strcmp(tag, "*") == 0) {
+        log_default = level;
+        log_tag_num = 0;
+    } else {
+        int i;
+        for (i = 0; i < log_tag_num && strcmp(log_tag[i].tag, tag) != 0; i++) {
+        }
+        if (i < LOG_TAG_MAX) {
+            log_tag[i].tag = tag;
+            log_tag[i].level = level;
+            log_tag_num = i == log_tag_num ? log_tag_num + 1 : log_tag_num;
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    pthread_mutex_lock(&log_lock);
+    if (log_cap < 0) {
+        const char *env = getenv("ROBOT_HOST_LOG");
+        log_cap = env ? atoi(env) : ESP_LOG_VERBOSE;
+    }
+    esp_log_level_t enabled = log_default;
+    for (int i = 0; i < log_tag_num; i++) {
+        if (strcmp(log_tag[i].tag, tag) == 0) {
+            enabled = log_tag[i].level;
+            break;
+        }
+    }
+    if (level <= enabled && (int)level <= log_cap) {
+        va_list list;
+        va_start(list, format);
+        vfprintf(stderr, format, list);
+        va_end(list);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,31 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _HOST_ESP_TIMER_H_
+#define _HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * us since the process started, CLOCK_MONOTONIC unless the clock is virtual
+ */
+int64_t esp_timer_get_time(void);
+
+/**
+ * Host only. Freeze the clock at its current value, from then on it moves by esp_timer_host_advance only
+ */
+void esp_timer_host_virtual(void);
+void esp_timer_host_advance(int64_t us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
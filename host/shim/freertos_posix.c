@@ -0,0 +1,417 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#define SHIM_TASK_NAME (16)
+
+struct shim_task {
+    pthread_t thread;
+    char name[SHIM_TASK_NAME];
+    TaskFunction_t func;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+struct shim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t can_send;
+    pthread_cond_t can_receive;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;           // next item to receive
+    int receiver_waiting;
+    uint8_t *buffer;
+};
+
+struct shim_event_group {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+static __thread struct shim_task *shim_self = NULL;
+static pthread_mutex_t shim_critical;
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+
+static void shim_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&shim_critical, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void shim_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// wait on cond until woken or the deadline, false on timeout. deadline NULL waits forever
+static bool shim_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline)
+{
+    if (deadline == NULL) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+// absolute CLOCK_MONOTONIC deadline ticks from now, NULL for portMAX_DELAY
+static struct timespec *shim_deadline(TickType_t ticks, struct timespec *ts)
+{
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    uint64_t nsec = (uint64_t)ts->tv_nsec + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL;
+    ts->tv_sec += nsec / 1000000000ULL;
+    ts->tv_nsec = nsec % 1000000000ULL;
+    return ts;
+}
+
+/*
+ * CRITICAL SECTION
+ */
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    pthread_once(&shim_once, shim_init);
+    pthread_mutex_lock(&shim_critical);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) { pthread_mutex_unlock(&shim_critical); }
+
+/*
+ * TASK
+ */
+static struct shim_task *shim_task_new(const char *name)
+{
+    struct shim_task *task = calloc(1, sizeof(struct shim_task));
+    if (task == NULL) {
+        return NULL;
+    }
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    pthread_mutex_init(&task->lock, NULL);
+    shim_cond_init(&task->cond);
+    return task;
+}
+
+static void *shim_task_entry(void *arg)
+{
+    struct shim_task *task = arg;
+    shim_self = task;
+    task->func(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    struct shim_task *task = shim_task_new(name);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->func = func;
+    task->arg = arg;
+    if (handle) {
+        *handle = task;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&task->thread, &attr, shim_task_entry, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        if (handle) {
+            *handle = NULL;
+        }
+        free(task);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == shim_self) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {
+        .tv_sec = ticks * portTICK_PERIOD_MS / 1000,
+        .tv_nsec = (long)(ticks * portTICK_PERIOD_MS % 1000) * 1000000L,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (shim_self == NULL) {
+        shim_self = shim_task_new("main");
+        shim_self->thread = pthread_self();
+    }
+    return shim_self;
+}
+
+TickType_t xTaskGetTickCount(void) { return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS); }
+
+char *pcTaskGetTaskName(TaskHandle_t task)
+{
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    return task->name;
+}
+
+// stacks are the pthread default, nothing to report
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct shim_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec ts;
+    struct timespec *deadline = shim_deadline(ticks, &ts);
+    pthread_mutex_lock(&task->lock);
+    while (task->notify == 0 && ticks != 0) {
+        if (shim_cond_wait(&task->cond, &task->lock, deadline) == false) {
+            break;
+        }
+    }
+    uint32_t value = task->notify;
+    if (value) {
+        task->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+/*
+ * QUEUE
+ */
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct shim_queue *queue = calloc(1, sizeof(struct shim_queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->buffer = calloc(length, item_size ? item_size : 1);
+    if (queue->buffer == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    shim_cond_init(&queue->can_send);
+    shim_cond_init(&queue->can_receive);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (queue == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->can_send);
+    pthread_cond_destroy(&queue->can_receive);
+    free(queue->buffer);
+    free(queue);
+}
+
+// must be called with the queue lock, slot is where the item goes. Semaphores give no item
+static void shim_queue_push(QueueHandle_t queue, const void *item, UBaseType_t slot)
+{
+    if (queue->item_size && item != NULL) {
+        memcpy(queue->buffer + slot * queue->item_size, item, queue->item_size);
+    }
+    pthread_cond_signal(&queue->can_receive);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    struct timespec *deadline = shim_deadline(ticks, &ts);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (ticks == 0 || shim_cond_wait(&queue->can_send, &queue->lock, deadline) == false) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    shim_queue_push(queue, item, (queue->head + queue->count) % queue->length);
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->length) {
+        pthread_mutex_unlock(&queue->lock);
+        return pdFAIL;
+    }
+    shim_queue_push(queue, item, (queue->head + queue->count) % queue->length);
+    queue->count++;
+    if (woken && queue->receiver_waiting) {
+        *woken = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item)
+{
+    pthread_mutex_lock(&queue->lock);
+    shim_queue_push(queue, item, queue->head);
+    queue->count = 1;
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    struct timespec *deadline = shim_deadline(ticks, &ts);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (ticks == 0) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+        queue->receiver_waiting++;
+        bool woken = shim_cond_wait(&queue->can_receive, &queue->lock, deadline);
+        queue->receiver_waiting--;
+        if (woken == false && queue->count == 0) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size && item) {
+        memcpy(item, queue->buffer + queue->head * queue->item_size, queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->can_send);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+    if (sem) {
+        xSemaphoreGive(sem);
+    }
+    return sem;
+}
+
+/*
+ * EVENT GROUP
+ */
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct shim_event_group *group = calloc(1, sizeof(struct shim_event_group));
+    if (group == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&group->lock, NULL);
+    shim_cond_init(&group->cond);
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    pthread_mutex_destroy(&group->lock);
+    pthread_cond_destroy(&group->cond);
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t value = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks)
+{
+    struct timespec ts;
+    struct timespec *deadline = shim_deadline(ticks, &ts);
+    pthread_mutex_lock(&group->lock);
+    while (1) {
+        EventBits_t set = group->bits & bits;
+        if (all ? set == bits : set != 0) {
+            EventBits_t value = group->bits;
+            if (clear) {
+                group->bits &= ~bits;
+            }
+            pthread_mutex_unlock(&group->lock);
+            return value;
+        }
+        if (ticks == 0 || shim_cond_wait(&group->cond, &group->lock, deadline) == false) {
+            break;
+        }
+    }
+    EventBits_t value = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
@@ -0,0 +1,18 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+
+/*
+ * Host build configuration, every value missing here takes its default from robot_config.h.
+ * STATS reads the xtensa cycle counter and the journal needs a flash partition, both stay off
+ */
+#define CONFIG_ROBOT_TRACE_ENABLE 1
+#define CONFIG_ROBOT_TRACE_DEPTH 256
+#define CONFIG_ROBOT_LATENCY_ENABLE 1
+
+#endif
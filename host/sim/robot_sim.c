@@ -0,0 +1,373 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "robot_config.h"
+#include "servo_control.h"
+#include "robot_hal_posix.h"
+
+/*
+ * Accelerated time simulator. The firmware runs unchanged over robot_hal_posix.c with the tick driven by hand
+ * on a virtual clock: a tick is fired as soon as the motion task finished the previous one, so a 20 ms period
+ * costs only the cpu time of one tick. Every servo is a first order plant with a rate limit following the
+ * pulse width on its pwm channel, integrated in 1 ms steps.
+ *
+ *   robot_sim [-r REPEAT] [-t TAU_MS] [-v RATE_US_PER_S] [-e TOLERANCE_US] [-q] SCRIPT
+ *
+ * SCRIPT holds one command per line as the pc sends it without the id, '#' starts a comment.
+ */
+void app_main(void);
+
+#define SIM_CHANNEL ROBOT_CHANNEL_NUM
+#define SIM_RESPONSE_MS (10000)      // real time, a stalled firmware fails the run
+#define SIM_SETTLE_MAX_MS (5000)     // virtual time after DONE
+#define SIM_COMMAND_MAX (256)
+#define SIM_LINE_SIZE (128)
+
+typedef struct {
+    double tau_ms;        // plant time constant
+    double rate_us;       // max slew, us per s
+    double tolerance;     // us, settled when every channel is this close to its pulse width
+    int repeat;
+    bool quiet;
+} sim_option_t;
+
+typedef struct {
+    double pos[SIM_CHANNEL];          // us, plant output, 0 until the channel gets its first pulse
+    double tick_pos[SIM_CHANNEL];     // at the previous tick, for velocity
+    double vel[SIM_CHANNEL];          // us/s over the previous tick
+} sim_plant_t;
+
+typedef struct {
+    int cycle_ms;         // command sent -> DONE
+    int settle_ms;        // command sent -> plant within tolerance, -1 => not in SIM_SETTLE_MAX_MS
+    double vel_max;       // us/s
+    double acc_max;       // us/s^2
+    int vel_channel;
+    int acc_channel;
+} sim_result_t;
+
+static sim_option_t option = {
+    .tau_ms = 40,
+    .rate_us = 4500,     // about 0.15 s per 60 degree
+    .tolerance = 10,
+    .repeat = 1,
+    .quiet = false,
+};
+
+static sim_plant_t plant;
+static int peer = -1;
+static char rx[1024];
+static int rx_len = 0;
+
+static int64_t sim_wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * SERIAL
+ */
+static int sim_send(int id, const char *command)
+{
+    char line[SIM_LINE_SIZE + 16];
+    char frame[2 * sizeof(line) + 2];
+    int len = snprintf(line, sizeof(line), "%d %s", id, command);
+    len = msg_pack(line, len, frame);
+    return write(peer, frame, len) == len ? 0 : -1;
+}
+
+// next response payload into line, wait at most timeout_ms. Return its length, 0 on timeout, -1 on error
+static int sim_response(char *line, int size, int timeout_ms)
+{
+    while (1) {
+        char *end = memchr(rx, 0x7F, rx_len);
+        if (end) {
+            int len = end - rx + 1;
+            char frame[sizeof(rx)];
+            memcpy(frame, rx, len);
+            memmove(rx, rx + len, rx_len - len);
+            rx_len -= len;
+            int payload = msg_unpack(frame, len);
+            if (payload <= 0 || payload >= size) {
+                return -1;
+            }
+            memcpy(line, frame, payload);
+            line[payload] = 0;
+            return payload;
+        }
+        struct pollfd pfd = {.fd = peer, .events = POLLIN};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == 0) {
+            return 0;
+        }
+        int n = ready > 0 ? read(peer, rx + rx_len, sizeof(rx) - rx_len) : -1;
+        if (n <= 0) {
+            return -1;
+        }
+        rx_len += n;
+    }
+}
+
+/*
+ * PLANT
+ */
+// one tick period of the plant against the pulse widths on the pwm now, track the peaks into result
+static void sim_plant_step(uint32_t period_ms, sim_result_t *result)
+{
+    double max_step = option.rate_us / 1000.0;
+    for (uint32_t t = 0; t < period_ms; t++) {
+        for (int i = 0; i < SIM_CHANNEL; i++) {
+            uint32_t duty = robot_hal_posix_pwm_read(i);
+            if (duty == 0) {
+                continue;     // output off, the servo holds
+            }
+            if (plant.pos[i] == 0) {
+                plant.pos[i] = plant.tick_pos[i] = duty;     // first pulse, the servo is taken to be there
+            }
+            double step = (duty - plant.pos[i]) / (option.tau_ms > 1 ? option.tau_ms : 1);
+            if (step > max_step) {
+                step = max_step;
+            } else if (step < -max_step) {
+                step = -max_step;
+            }
+            plant.pos[i] += step;
+        }
+    }
+    // velocity and acceleration over the tick, a 1 ms difference only shows the staircase of the pwm
+    for (int i = 0; i < SIM_CHANNEL; i++) {
+        double vel = (plant.pos[i] - plant.tick_pos[i]) * 1000.0 / period_ms;
+        double acc = (vel - plant.vel[i]) * 1000.0 / period_ms;
+        plant.tick_pos[i] = plant.pos[i];
+        plant.vel[i] = vel;
+        if (fabs(vel) > result->vel_max) {
+            result->vel_max = fabs(vel);
+            result->vel_channel = i;
+        }
+        if (fabs(acc) > result->acc_max) {
+            result->acc_max = fabs(acc);
+            result->acc_channel = i;
+        }
+    }
+}
+
+static bool sim_plant_settled(void)
+{
+    for (int i = 0; i < SIM_CHANNEL; i++) {
+        uint32_t duty = robot_hal_posix_pwm_read(i);
+        if (duty != 0 && fabs(duty - plant.pos[i]) > option.tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * RUN
+ */
+// answers that end a command, anything else (PROCESSING, report lines) is skipped
+static bool sim_final(const char *answer)
+{
+    return strcmp(answer, "DONE") == 0 || strncmp(answer, "ERROR", 5) == 0 || strncmp(answer, "OK", 2) == 0 ||
+           strcmp(answer, "UNREACHABLE") == 0 || strcmp(answer, "OVERFLOW") == 0;
+}
+
+// run one command to its final answer, then the plant alone until it settles. Return 0 on DONE or OK
+static int sim_command(int id, const char *command, sim_result_t *result, char *answer, int size)
+{
+    memset(result, 0, sizeof(*result));
+    result->settle_ms = -1;
+    int64_t start = esp_timer_get_time();
+    if (sim_send(id, command) != 0) {
+        snprintf(answer, size, "ERROR TRANSMIT");
+        return -1;
+    }
+    char line[SIM_LINE_SIZE];
+    int64_t waited = sim_wall_us();
+    while (1) {
+        // pending answers first, DONE is sent after the tick that ended the motion reported done
+        int len = sim_response(line, sizeof(line), 0);
+        if (len > 0) {
+            char *colon = strchr(line, ':');
+            if (colon && atoi(line) == id && sim_final(colon + 1)) {
+                snprintf(answer, size, "%s", colon + 1);
+                break;
+            }
+            continue;
+        }
+        if (len < 0) {
+            snprintf(answer, size, "ERROR TRANSMIT");
+            return -1;
+        }
+        if (robot_hal_posix_tick_step()) {
+            sim_plant_step(ROBOT_TICK_MS, result);
+            waited = sim_wall_us();
+            continue;
+        }
+        // tick paused: the command is still parsed or the answer is on its way
+        if (sim_wall_us() - waited > SIM_RESPONSE_MS * 1000LL) {
+            snprintf(answer, size, "TIMEOUT");
+            return -1;
+        }
+        usleep(100);
+    }
+    result->cycle_ms = (int)((esp_timer_get_time() - start) / 1000);
+    // the tick is paused once the arm is at rest, the plant keeps following the last pulse width
+    for (int t = 0; t <= SIM_SETTLE_MAX_MS; t += ROBOT_TICK_MS) {
+        if (sim_plant_settled()) {
+            result->settle_ms = (int)((esp_timer_get_time() - start) / 1000);
+            break;
+        }
+        esp_timer_host_advance(ROBOT_TICK_MS * 1000);
+        sim_plant_step(ROBOT_TICK_MS, result);
+    }
+    return strcmp(answer, "DONE") == 0 || strncmp(answer, "OK", 2) == 0 ? 0 : -1;
+}
+
+static int sim_load(const char *path, char command[][SIM_LINE_SIZE])
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    int num = 0;
+    char line[SIM_LINE_SIZE];
+    while (fgets(line, sizeof(line), file)) {
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = 0;
+        }
+        char *begin = line;
+        while (*begin == ' ' || *begin == '\t') {
+            begin++;
+        }
+        int len = strlen(begin);
+        while (len > 0 && (begin[len - 1] == '\n' || begin[len - 1] == '\r' || begin[len - 1] == ' ')) {
+            begin[--len] = 0;
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (num == SIM_COMMAND_MAX) {
+            fprintf(stderr, "%s: more than %d commands\n", path, SIM_COMMAND_MAX);
+            break;
+        }
+        strcpy(command[num++], begin);
+    }
+    fclose(file);
+    return num;
+}
+
+static void sim_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-r REPEAT] [-t TAU_MS] [-v RATE_US_PER_S] [-e TOLERANCE_US] [-q] SCRIPT\n"
+            "  -r  replay the script REPEAT times, default 1\n"
+            "  -t  servo time constant, default %.0f ms\n"
+            "  -v  servo slew limit, default %.0f us/s\n"
+            "  -e  settle tolerance, default %.0f us\n"
+            "  -q  summary only\n",
+            name, option.tau_ms, option.rate_us, option.tolerance);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:v:e:q")) != -1) {
+        switch (opt) {
+        case 'r':
+            option.repeat = atoi(optarg);
+            break;
+        case 't':
+            option.tau_ms = atof(optarg);
+            break;
+        case 'v':
+            option.rate_us = atof(optarg);
+            break;
+        case 'e':
+            option.tolerance = atof(optarg);
+            break;
+        case 'q':
+            option.quiet = true;
+            break;
+        default:
+            sim_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || option.repeat < 1 || option.rate_us <= 0) {
+        sim_usage(argv[0]);
+        return 2;
+    }
+    static char command[SIM_COMMAND_MAX][SIM_LINE_SIZE];
+    int command_num = sim_load(argv[optind], command);
+    if (command_num <= 0) {
+        return 2;
+    }
+
+    setenv("ROBOT_HOST_LOG", "2", 0);
+    robot_hal_posix_tick_manual();
+    app_main();
+    while ((peer = robot_hal_posix_serial_peer()) < 0) {
+        vTaskDelay(1);
+    }
+    char line[SIM_LINE_SIZE];
+    if (sim_response(line, sizeof(line), SIM_RESPONSE_MS) <= 0 || strcmp(line, "32767:READY") != 0) {
+        fprintf(stderr, "no READY from the firmware\n");
+        return 1;
+    }
+
+    int run = 0, fail = 0, unsettled = 0;
+    int cycle_max = 0, settle_max = 0;
+    double vel_max = 0, acc_max = 0;
+    int64_t virtual_start = esp_timer_get_time();
+    int64_t wall_start = sim_wall_us();
+    for (int r = 0; r < option.repeat; r++) {
+        for (int i = 0; i < command_num; i++) {
+            sim_result_t result;
+            char answer[SIM_LINE_SIZE];
+            int id = run % 32000 + 1;
+            int err = sim_command(id, command[i], &result, answer, sizeof(answer));
+            run++;
+            fail += err != 0;
+            unsettled += result.settle_ms < 0;
+            cycle_max = result.cycle_ms > cycle_max ? result.cycle_ms : cycle_max;
+            settle_max = result.settle_ms > settle_max ? result.settle_ms : settle_max;
+            vel_max = result.vel_max > vel_max ? result.vel_max : vel_max;
+            acc_max = result.acc_max > acc_max ? result.acc_max : acc_max;
+            if (option.quiet == false || err != 0) {
+                printf("SIM %d \"%s\" %s cycle=%d settle=%d ms vmax=%.0f us/s ch%d amax=%.0f us/s2 ch%d\n", run,
+                       command[i], answer, result.cycle_ms, result.settle_ms, result.vel_max, result.vel_channel,
+                       result.acc_max, result.acc_channel);
+            }
+            if (err != 0 && strcmp(answer, "TIMEOUT") == 0) {
+                fprintf(stderr, "firmware stalled on \"%s\"\n", command[i]);
+                return 1;
+            }
+        }
+    }
+    double virtual_s = (esp_timer_get_time() - virtual_start) / 1e6;
+    double wall_s = (sim_wall_us() - wall_start) / 1e6;
+    printf("SIM TOTAL commands=%d failed=%d unsettled=%d cycle_max=%d settle_max=%d ms vmax=%.0f us/s "
+           "amax=%.0f us/s2\n",
+           run, fail, unsettled, cycle_max, settle_max, vel_max, acc_max);
+    printf("SIM TIME virtual=%.3f s wall=%.3f s speedup=%.1fx\n", virtual_s, wall_s,
+           wall_s > 0 ? virtual_s / wall_s : 0);
+    return fail || unsettled ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "servo_control.h"
+#include "robot_hal_posix.h"
+
+// boot, then a few commands through the framed serial port exactly as the pc sends them
+void app_main(void);
+
+#define RESPONSE_TIMEOUT_MS (10000)
+
+static int peer = -1;
+static char rx[1024];
+static int rx_len = 0;
+
+#define CHECK(cond)                                                                                              \
+    do {                                                                                                         \
+        if (!(cond)) {                                                                                           \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);                                      \
+            exit(1);                                                                                             \
+        }                                                                                                        \
+    } while (0)
+
+static void send_command(const char *command)
+{
+    char frame[256];
+    int len = msg_pack((char *)command, strlen(command), frame);
+    CHECK(write(peer, frame, len) == len);
+}
+
+// next response frame payload into line, 0 on timeout
+static int read_response(char *line, int size)
+{
+    while (1) {
+        char *end = memchr(rx, 0x7F, rx_len);
+        if (end) {
+            int len = end - rx + 1;
+            char frame[sizeof(rx)];
+            memcpy(frame, rx, len);
+            memmove(rx, rx + len, rx_len - len);
+            rx_len -= len;
+            int payload = msg_unpack(frame, len);
+            CHECK(payload > 0 && payload < size);
+            memcpy(line, frame, payload);
+            line[payload] = 0;
+            return payload;
+        }
+        struct pollfd pfd = {.fd = peer, .events = POLLIN};
+        if (poll(&pfd, 1, RESPONSE_TIMEOUT_MS) <= 0) {
+            return 0;
+        }
+        int n = read(peer, rx + rx_len, sizeof(rx) - rx_len);
+        CHECK(n > 0);
+        rx_len += n;
+    }
+}
+
+static void expect(const char *want)
+{
+    char line[256];
+    CHECK(read_response(line, sizeof(line)) > 0);
+    if (strncmp(line, want, strlen(want)) != 0) {
+        fprintf(stderr, "FAIL expected \"%s\", got \"%s\"\n", want, line);
+        exit(1);
+    }
+    printf("%s\n", line);
+}
+
+int main(void)
+{
+    app_main();
+    while ((peer = robot_hal_posix_serial_peer()) < 0) {
+        vTaskDelay(1);
+    }
+    expect("32767:READY");
+
+    // dry run, answered right away
+    send_command("1 VALIDATE 0 0 20 10");
+    expect("1:OK ");
+
+    send_command("2 SETPOS 0 20 10");
+    expect("2:PROCESSING");
+    expect("2:DONE");
+
+    // at rest the pwm holds the pose the planner reports
+    int duty[6];
+    double cripper_len;
+    CHECK(robot_get_pose(duty, &cripper_len) == ESP_OK);
+    for (int i = 0; i < 6; i++) {
+        CHECK(robot_hal_posix_pwm_read(i) == (uint32_t)duty[i]);
+    }
+
+    // a dry run neither fills nor reads the ik cache
+    robot_target_t target = {.kind = ROBOT_TARGET_POSITION, .x = 0, .y = 20, .z = 10};
+    robot_validate_result_t result;
+    ik_cache_stats_t cache_before, cache_after;
+    CHECK(robot_get_ik_cache_stats(&cache_before) == ESP_OK);
+    CHECK(robot_validate(&target, 1, &result) == ESP_OK && result.reachable);
+    CHECK(robot_get_ik_cache_stats(&cache_after) == ESP_OK);
+    CHECK(cache_after.hit == cache_before.hit && cache_after.miss == cache_before.miss);
+
+    // a cached SETPOS leaves the cripper where it is now, not where it was when the entry was made.
+    // the solution can depend on the start pose, the entry is made from the pose the arm rests at
+    send_command("6 SETPOS 0 20 10");
+    expect("6:PROCESSING");
+    expect("6:DONE");
+    int cripper = duty[5] == 1400 ? 1600 : 1400;
+    char command[64];
+    snprintf(command, sizeof(command), "7 SETDUTY %d 6", cripper);
+    send_command(command);
+    expect("7:PROCESSING");
+    expect("7:DONE");
+    CHECK(robot_hal_posix_pwm_read(5) == (uint32_t)cripper);
+    CHECK(robot_get_ik_cache_stats(&cache_before) == ESP_OK);
+    send_command("8 SETPOS 0 20 10");
+    expect("8:PROCESSING");
+    expect("8:DONE");
+    CHECK(robot_get_ik_cache_stats(&cache_after) == ESP_OK);
+    CHECK(cache_after.hit == cache_before.hit + 1);
+    CHECK(robot_hal_posix_pwm_read(5) == (uint32_t)cripper);
+    for (int i = 0; i < 5; i++) {
+        CHECK(robot_hal_posix_pwm_read(i) == (uint32_t)duty[i]);
+    }
+
+    // the factory table reaches 0.97 cm, the gripper is still never driven below its 2 cm limit
+    robot_target_t grip = {.kind = ROBOT_TARGET_WIDTH_POSITION, .x = 0, .y = 20, .z = 10, .width = 1.5};
+    CHECK(robot_validate(&grip, 1, &result) == ESP_OK && result.reachable == false);
+    grip.width = 2.4;
+    CHECK(robot_validate(&grip, 1, &result) == ESP_OK && result.reachable);
+
+    send_command("3 SETHOME");
+    expect("3:PROCESSING");
+    expect("3:DONE");
+
+    send_command("4 NOSUCH");
+    expect("4:ERROR COMMAND");
+
+    send_command("5 BOOTINFO");
+    char line[256];
+    do {
+        CHECK(read_response(line, sizeof(line)) > 0);
+        printf("%s\n", line);
+    } while (strcmp(line, "5:DONE") != 0);
+
+    printf("host smoke test passed\n");
+    return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "robot_config.h"
+#include "servo_lspb.h"
+
+/*
+ * Golden trajectory test of the lspb planner. A plan script is run tick by tick through _servo_channel_adopt
+ * and _servo_channel_step, the per channel code the motion tick adopts a trajectory and steps with, the per
+ * channel duty stream is compared with a golden file. The script is replayed to measure the planner cpu time.
+ *
+ *   planner_golden [-t TOLERANCE_US] [-m MISMATCH] [-r REPEAT] [-u] SCRIPT GOLDEN
+ *
+ * SCRIPT, '#' starts a comment:
+ *   START D0 .. D5               duty every channel starts at, first line
+ *   MOVE TF TB D0 .. D5 [TICKS]  adopt targets with time_full / time_balance ms, "-" leaves a channel on its plan.
+ *                                runs until every channel is idle, or TICKS ticks when the next move cuts in
+ * GOLDEN, '#' starts a comment: one line per tick, TICK D0 .. D5
+ */
+
+#define PLAN_CHANNEL ROBOT_CHANNEL_NUM
+#define PLAN_STEP_MAX (1024)
+#define PLAN_TICK_MAX (1 << 20)     // a planner that never ends fails instead of filling the memory
+#define PLAN_KEEP (-1)              // "-" in a MOVE
+
+typedef struct {
+    bool start;
+    int time_full;
+    int time_balance;
+    int duty[PLAN_CHANNEL];
+    int ticks;     // 0 => until idle
+} plan_step_t;
+
+typedef struct {
+    int tick;
+    int duty[PLAN_CHANNEL];
+} plan_sample_t;
+
+typedef struct {
+    plan_sample_t *sample;
+    int num;
+    int size;
+} plan_stream_t;
+
+typedef struct {
+    int tolerance;     // us a sample may differ by
+    int mismatch;      // samples allowed beyond tolerance
+    int repeat;
+    bool update;
+} plan_option_t;
+
+static plan_option_t option = {
+    .tolerance = 0,
+    .mismatch = 0,
+    .repeat = 200,
+    .update = false,
+};
+
+static int plan_load(const char *path, plan_step_t *step)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    int num = 0, line_num = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = 0;
+        }
+        char *word[PLAN_CHANNEL + 4];
+        int word_num = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok && word_num < PLAN_CHANNEL + 4; tok = strtok(NULL, " \t\r\n")) {
+            word[word_num++] = tok;
+        }
+        if (word_num == 0) {
+            continue;
+        }
+        if (num == PLAN_STEP_MAX) {
+            fprintf(stderr, "%s: more than %d steps\n", path, PLAN_STEP_MAX);
+            fclose(file);
+            return -1;
+        }
+        plan_step_t *s = &step[num];
+        memset(s, 0, sizeof(*s));
+        int first;
+        if (strcmp(word[0], "START") == 0 && word_num == 1 + PLAN_CHANNEL && num == 0) {
+            s->start = true;
+            first = 1;
+        } else if (strcmp(word[0], "MOVE") == 0 && word_num >= 3 + PLAN_CHANNEL && word_num <= 4 + PLAN_CHANNEL &&
+                   num > 0) {
+            s->time_full = atoi(word[1]);
+            s->time_balance = atoi(word[2]);
+            s->ticks = word_num == 4 + PLAN_CHANNEL ? atoi(word[3 + PLAN_CHANNEL]) : 0;
+            first = 3;
+        } else {
+            fprintf(stderr, "%s:%d: expected START first, then MOVE lines\n", path, line_num);
+            fclose(file);
+            return -1;
+        }
+        for (int i = 0; i < PLAN_CHANNEL; i++) {
+            s->duty[i] = strcmp(word[first + i], "-") == 0 && s->start == false ? PLAN_KEEP : atoi(word[first + i]);
+        }
+        num++;
+    }
+    fclose(file);
+    return num;
+}
+
+static int plan_record(plan_stream_t *stream, int tick, const servo_channel_ctrl_t *channel)
+{
+    if (stream == NULL) {
+        return 0;
+    }
+    if (stream->num == stream->size) {
+        int size = stream->size ? stream->size * 2 : 1024;
+        plan_sample_t *sample = realloc(stream->sample, size * sizeof(plan_sample_t));
+        if (sample == NULL) {
+            return -1;
+        }
+        stream->sample = sample;
+        stream->size = size;
+    }
+    plan_sample_t *s = &stream->sample[stream->num++];
+    s->tick = tick;
+    for (int i = 0; i < PLAN_CHANNEL; i++) {
+        s->duty[i] = channel[i].duty_current;
+    }
+    return 0;
+}
+
+// step every channel once as _servo_set_duty does, return how many were running, -1 on a channel error
+static int plan_tick(servo_channel_ctrl_t *channel)
+{
+    int running = 0;
+    for (int i = 0; i < PLAN_CHANNEL; i++) {
+        servo_lspb_phase_t phase;
+        servo_status_t status = _servo_channel_step(&channel[i], i, &phase);
+        if (status == SERVO_STATUS_ERROR) {
+            return -1;
+        }
+        running += status == SERVO_STATUS_RUNNING;
+    }
+    return running;
+}
+
+// run the script once, stream is NULL for the timed runs. Return the tick count, -1 on error
+static int plan_run(const plan_step_t *step, int step_num, plan_stream_t *stream)
+{
+    servo_channel_ctrl_t channel[PLAN_CHANNEL];
+    memset(channel, 0, sizeof(channel));
+    int tick = 0;
+    for (int n = 0; n < step_num; n++) {
+        const plan_step_t *s = &step[n];
+        for (int i = 0; i < PLAN_CHANNEL; i++) {
+            if (s->start) {
+                channel[i].duty_current = channel[i].duty_target = s->duty[i];
+            } else if (s->duty[i] != PLAN_KEEP) {
+                // the tick adopting a trajectory replans from where the channel is
+                _servo_channel_adopt(&channel[i], s->duty[i], s->time_full, s->time_balance);
+            }
+        }
+        if (s->start) {
+            continue;
+        }
+        for (int t = 0; s->ticks == 0 || t < s->ticks; t++) {
+            int running = plan_tick(channel);
+            if (running < 0) {
+                return -1;
+            } else if (running == 0) {
+                break;
+            }
+            if (plan_record(stream, tick, channel) != 0 || ++tick == PLAN_TICK_MAX) {
+                return -1;
+            }
+        }
+    }
+    return tick;
+}
+
+static int golden_write(const char *path, const char *script, const plan_stream_t *stream)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    const char *name = strrchr(script, '/');
+    fprintf(file, "# golden duty stream of %s, robot_real_t %s\n", name ? name + 1 : script,
+            sizeof(robot_real_t) == sizeof(float) ? "float" : "double");
+    fprintf(file, "# TICK D0 .. D%d\n", PLAN_CHANNEL - 1);
+    for (int n = 0; n < stream->num; n++) {
+        fprintf(file, "%d", stream->sample[n].tick);
+        for (int i = 0; i < PLAN_CHANNEL; i++) {
+            fprintf(file, " %d", stream->sample[n].duty[i]);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    return 0;
+}
+
+static int golden_load(const char *path, plan_stream_t *stream)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        servo_channel_ctrl_t channel[PLAN_CHANNEL];
+        int tick;
+        int read = sscanf(line, "%d %d %d %d %d %d %d", &tick, &channel[0].duty_current, &channel[1].duty_current,
+                          &channel[2].duty_current, &channel[3].duty_current, &channel[4].duty_current,
+                          &channel[5].duty_current);
+        if (read != 1 + PLAN_CHANNEL || plan_record(stream, tick, channel) != 0) {
+            fprintf(stderr, "%s: bad line \"%s\"\n", path, line);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// samples beyond tolerance, a tick only one stream has counts every channel
+static int golden_compare(const plan_stream_t *got, const plan_stream_t *want)
+{
+    int mismatch = 0, error_max = 0;
+    int num = got->num > want->num ? got->num : want->num;
+    for (int n = 0; n < num; n++) {
+        if (n >= got->num || n >= want->num) {
+            if (mismatch == 0) {
+                printf("GOLDEN first mismatch tick %d: %s\n", n, n >= got->num ? "missing" : "extra");
+            }
+            mismatch += PLAN_CHANNEL;
+            continue;
+        }
+        for (int i = 0; i < PLAN_CHANNEL; i++) {
+            int error = abs(got->sample[n].duty[i] - want->sample[n].duty[i]);
+            error_max = error > error_max ? error : error_max;
+            if (error <= option.tolerance) {
+                continue;
+            }
+            if (mismatch == 0) {
+                printf("GOLDEN first mismatch tick %d channel %d: got %d, golden %d\n", want->sample[n].tick, i,
+                       got->sample[n].duty[i], want->sample[n].duty[i]);
+            }
+            mismatch++;
+        }
+    }
+    printf("GOLDEN ticks=%d golden=%d max_error=%d us tolerance=%d us mismatch=%d allowed=%d\n", got->num, want->num,
+           error_max, option.tolerance, mismatch, option.mismatch);
+    return mismatch;
+}
+
+static double plan_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void plan_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-t TOLERANCE_US] [-m MISMATCH] [-r REPEAT] [-u] SCRIPT GOLDEN\n"
+            "  -t  us a duty may differ from the golden one, default %d\n"
+            "  -m  samples allowed beyond the tolerance, default %d\n"
+            "  -r  timed replays of the script, default %d\n"
+            "  -u  write GOLDEN from this build instead of comparing\n",
+            name, option.tolerance, option.mismatch, option.repeat);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:r:u")) != -1) {
+        switch (opt) {
+        case 't':
+            option.tolerance = atoi(optarg);
+            break;
+        case 'm':
+            option.mismatch = atoi(optarg);
+            break;
+        case 'r':
+            option.repeat = atoi(optarg);
+            break;
+        case 'u':
+            option.update = true;
+            break;
+        default:
+            plan_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 2 || option.repeat < 1) {
+        plan_usage(argv[0]);
+        return 2;
+    }
+    const char *script = argv[optind], *golden = argv[optind + 1];
+    static plan_step_t step[PLAN_STEP_MAX];
+    int step_num = plan_load(script, step);
+    if (step_num <= 0) {
+        return 2;
+    }
+
+    plan_stream_t got = {0};
+    int ticks = plan_run(step, step_num, &got);
+    if (ticks < 0) {
+        fprintf(stderr, "%s: a channel without duty, or the planner did not finish in %d ticks\n", script,
+                PLAN_TICK_MAX);
+        return 1;
+    }
+    double begin = plan_cpu_ns();
+    for (int r = 0; r < option.repeat; r++) {
+        plan_run(step, step_num, NULL);
+    }
+    double cpu_ns = (plan_cpu_ns() - begin) / option.repeat;
+    printf("PLANNER %s robot_real_t=%s ticks=%d cpu=%.1f us/run %.1f ns/tick (%d runs)\n", script,
+           sizeof(robot_real_t) == sizeof(float) ? "float" : "double", ticks, cpu_ns / 1000,
+           ticks ? cpu_ns / ticks : 0, option.repeat);
+
+    if (option.update) {
+        return golden_write(golden, script, &got) == 0 ? 0 : 1;
+    }
+    plan_stream_t want = {0};
+    if (golden_load(golden, &want) != 0) {
+        return 1;
+    }
+    int mismatch = golden_compare(&got, &want);
+    free(got.sample);
+    free(want.sample);
+    printf("%s\n", mismatch <= option.mismatch ? "PASS" : "FAIL");
+    return mismatch <= option.mismatch ? 0 : 1;
+}
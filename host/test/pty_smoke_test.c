@@ -0,0 +1,154 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "servo_control.h"
+
+// start robot_pty, then talk to it through its pty as the pc controller does
+//   robot_pty_test ROBOT_PTY [ARG ..]
+
+#define RESPONSE_TIMEOUT_MS (10000)
+#define BURST (64)
+
+static pid_t child = -1;
+static int port = -1;
+static char rx[4096];
+static int rx_len = 0;
+
+#define CHECK(cond)                                                                                              \
+    do {                                                                                                         \
+        if (!(cond)) {                                                                                           \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);                                      \
+            if (child > 0) {                                                                                     \
+                kill(child, SIGTERM);                                                                            \
+            }                                                                                                    \
+            exit(1);                                                                                             \
+        }                                                                                                        \
+    } while (0)
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void send_command(const char *command)
+{
+    char frame[256];
+    int len = msg_pack((char *)command, strlen(command), frame);
+    CHECK(write(port, frame, len) == len);
+}
+
+// next response frame payload into line, 0 on timeout
+static int read_response(char *line, int size)
+{
+    while (1) {
+        char *end = memchr(rx, 0x7F, rx_len);
+        if (end) {
+            int len = end - rx + 1;
+            char frame[sizeof(rx)];
+            memcpy(frame, rx, len);
+            memmove(rx, rx + len, rx_len - len);
+            rx_len -= len;
+            int payload = msg_unpack(frame, len);
+            CHECK(payload > 0 && payload < size);
+            memcpy(line, frame, payload);
+            line[payload] = 0;
+            return payload;
+        }
+        struct pollfd pfd = {.fd = port, .events = POLLIN};
+        if (poll(&pfd, 1, RESPONSE_TIMEOUT_MS) <= 0) {
+            return 0;
+        }
+        int n = read(port, rx + rx_len, sizeof(rx) - rx_len);
+        CHECK(n > 0);
+        rx_len += n;
+    }
+}
+
+static void expect(const char *want)
+{
+    char line[256];
+    CHECK(read_response(line, sizeof(line)) > 0);
+    if (strncmp(line, want, strlen(want)) != 0) {
+        fprintf(stderr, "FAIL expected \"%s\", got \"%s\"\n", want, line);
+        kill(child, SIGTERM);
+        exit(1);
+    }
+    printf("%s\n", line);
+}
+
+int main(int argc, char **argv)
+{
+    CHECK(argc >= 2);
+    int out[2];
+    CHECK(pipe(out) == 0);
+    child = fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        execv(argv[1], argv + 1);
+        _exit(127);
+    }
+    close(out[1]);
+
+    // first line of robot_pty is the port to open
+    char path[128];
+    int len = 0;
+    while (len < (int)sizeof(path) - 1) {
+        CHECK(read(out[0], path + len, 1) == 1);
+        if (path[len] == '\n') {
+            break;
+        }
+        len++;
+    }
+    path[len] = 0;
+    port = open(path, O_RDWR | O_NOCTTY);
+    CHECK(port >= 0);
+    struct termios tio;
+    CHECK(tcgetattr(port, &tio) == 0);
+    cfmakeraw(&tio);
+    CHECK(tcsetattr(port, TCSANOW, &tio) == 0);
+
+    expect("32767:READY");
+    send_command("1 VALIDATE 1 0 6 2 45");
+    expect("1:OK ");
+    send_command("2 SETPOS 0 20 10");
+    expect("2:PROCESSING");
+    expect("2:DONE");
+
+    // back to back dry runs, queued by the firmware and answered in order
+    double begin = now_ms();
+    for (int i = 0; i < BURST; i++) {
+        char command[64];
+        snprintf(command, sizeof(command), "%d VALIDATE 0 0 20 10", 100 + i);
+        send_command(command);
+    }
+    for (int i = 0; i < BURST; i++) {
+        char line[256], want[16];
+        CHECK(read_response(line, sizeof(line)) > 0);
+        snprintf(want, sizeof(want), "%d:OK ", 100 + i);
+        CHECK(strncmp(line, want, strlen(want)) == 0);
+    }
+    printf("%d VALIDATE round trips in %.1f ms\n", BURST, now_ms() - begin);
+
+    kill(child, SIGTERM);
+    int status;
+    waitpid(child, &status, 0);
+    printf("pty smoke test passed\n");
+    return 0;
+}
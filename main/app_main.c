@@ -8,37 +8,52 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "nvs.h"
-#include "nvs_flash.h"
-
-#include "driver/mcpwm.h"
-#include "soc/mcpwm_periph.h"
-
-#include "driver/gpio.h"
-#include "driver/uart.h"
 
 #include "esp_attr.h"
 #include "esp_err.h"
 #include "esp_log.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "dlog.h"
+#include "robot_boot.h"
+#include "robot_hal.h"
+#include "robot_latency.h"
+#include "robot_pose.h"
+#include "robot_stats.h"
+#include "robot_trace.h"
 #include "servo_control.h"
 
 static const char *TAG = "ROBOT";
 
-#define UART_TXD_PINNUM (10)     //(1)
-#define UART_RXD_PINNUM (9)      //(3)
-#define UART_RTS_PINNUM (5)      // UART_PIN_NO_CHANGE
-#define UART_CTS_PINNUM (18)     // UART_PIN_NO_CHANGE
-#define UART_NUM UART_NUM_1
+#define UART_BAUD_RATE (115200)
+
+#define BUF_SIZE ROBOT_UART_BUF_SIZE
+
+// binary frame: first payload byte is an opcode below any ascii command id
+#define BIN_FRAME_MAX_OPCODE (0x1F)
+#define BIN_OPCODE_RESPONSE (0x80)     // set in the opcode of a binary response
+#define BIN_OPCODE_GOTO (0x01)         // [opcode][id_command][pose id]
+#define BIN_OPCODE_VALIDATE (0x02)     // [opcode][id_command][num][point x num]
+#define BIN_OPCODE_TRACE (0x03)        // response only, [opcode][id_command][chunk][chunk num][num][record x num]
 
-#define BUF_SIZE (1024*2)
+#define TRACE_CHUNK_RECORD (16)
+
+#define VALIDATE_BATCH_MAX (64)
+#define VALIDATE_POINT_SIZE (1 + 5 * 4)
+#define VALIDATE_RESULT_SIZE (1 + 7 * 2)
+
+#define UART_READ_SIZE (128)
+#define UART_READ_TIMEOUT_MS (100)     // idle wait for the first byte of a frame
+#define REP_WAIT_MS (1000)             // motion wait slice, the status is checked again after it
 
 static char uart_buffer[BUF_SIZE] = {0};
+static char frame_buffer[BUF_SIZE] = {0};
 static int uart_buffer_idx = 0;
 
 typedef enum {
@@ -52,19 +67,210 @@ typedef enum {
     SET_WIDnPOS,
     SET_POSnARGnWID,
     SAVE,
+    GOTO,
+    SET_IKSEL,
+    SET_GRIPPT,
+    SAVE_GRIP,
+    VALIDATE,
+    STATS,
+    TRACE,
+    LATENCY,
+    BOOTINFO,
     REP,
 } robot_mode_t;
 
 void robot_response(int id_command, char *message);
+void robot_response_binary(uint8_t *payload, int payload_len);
 
 static robot_mode_t mode = IDLE;
+static bool command_moves = false;     // the command being answered plans a motion, FIRST_MOVE is one of them
+#if CONFIG_ROBOT_LATENCY_ENABLE
+static bool latency_append = false;     // LATENCY APPEND ON: intervals of the command follow its DONE
+#endif
+
+// VALIDATE request point: [kind u8][x f32][y f32][z f32][angle f32][width f32], little endian
+// VALIDATE result point:  [reachable u8][duty u16 x 6][duration ms u16]
+static void robot_validate_binary(uint8_t *payload, int payload_len)
+{
+    int id_command = payload[1];
+    int num = payload[2];
+    if (num == 0 || num > VALIDATE_BATCH_MAX || payload_len != 3 + num * VALIDATE_POINT_SIZE) {
+        ESP_LOGE(TAG, "validate batch num: %d, len: %d", num, payload_len);
+        robot_response(id_command, "ERROR ARGUMENT");
+        return;
+    }
+    robot_target_t *target = (robot_target_t *)calloc(num, sizeof(robot_target_t));
+    robot_validate_result_t *result = (robot_validate_result_t *)calloc(num, sizeof(robot_validate_result_t));
+    uint8_t *response = (uint8_t *)calloc(3 + num * VALIDATE_RESULT_SIZE, sizeof(uint8_t));
+    if (target == NULL || result == NULL || response == NULL) {
+        robot_response(id_command, "ERROR");
+        goto _validate_binary_exit;
+    }
+    for (int n = 0; n < num; n++) {
+        uint8_t *point = payload + 3 + n * VALIDATE_POINT_SIZE;
+        float value[5];
+        memcpy(value, point + 1, sizeof(value));
+        target[n].kind = (robot_target_kind_t)point[0];
+        target[n].x = value[0];
+        target[n].y = value[1];
+        target[n].z = value[2];
+        target[n].angle = value[3];
+        target[n].width = value[4];
+    }
+    robot_validate(target, num, result);
+
+    response[0] = BIN_OPCODE_VALIDATE | BIN_OPCODE_RESPONSE;
+    response[1] = id_command;
+    response[2] = num;
+    for (int n = 0; n < num; n++) {
+        uint8_t *point = response + 3 + n * VALIDATE_RESULT_SIZE;
+        uint16_t value[7];
+        for (int i = 0; i < 6; i++) {
+            value[i] = (uint16_t)result[n].duty[i];
+        }
+        value[6] = (uint16_t)result[n].duration;
+        point[0] = result[n].reachable;
+        memcpy(point + 1, value, sizeof(value));
+    }
+    robot_response_binary(response, 3 + num * VALIDATE_RESULT_SIZE);
+_validate_binary_exit:
+    free(response);
+    free(result);
+    free(target);
+}
+
+// binary commands skip the ascii command table, arguments are passed on in para
+static robot_mode_t robot_read_binary_command(uint8_t *payload, int payload_len, int *id_command, char *para)
+{
+    switch (payload[0]) {
+    case BIN_OPCODE_GOTO:
+        if (payload_len != 3) {
+            break;
+        }
+        *id_command = payload[1];
+        snprintf(para, 4, "%u", payload[2]);
+        return GOTO;
+    case BIN_OPCODE_VALIDATE:
+        if (payload_len < 3) {
+            break;
+        }
+        // dry run does not move the arm, it is answered right away
+        robot_validate_binary(payload, payload_len);
+        return IDLE;
+    default:
+        break;
+    }
+    ESP_LOGE(TAG, "error binary command: %02X, len: %d", payload[0], payload_len);
+    robot_response((int)(INT16_MAX), "ERROR COMMAND");
+    return IDLE;
+}
+
+// take the first len bytes (one frame) out of uart_buffer and decode it
+static robot_mode_t robot_read_frame(int len, int *id_command, char *para)
+{
+    char command[16] = {0};
+    memset(frame_buffer, 0, sizeof(frame_buffer));
+    memmove(frame_buffer, uart_buffer, len);
+    // ESP_LOG_BUFFER_HEX("debug, uartbuffer",uart_buffer, data_len);
+    // ESP_LOG_BUFFER_HEX("debug, buff",buff, len);
+    memmove(uart_buffer, uart_buffer + len, uart_buffer_idx - len);
+    uart_buffer_idx -= len;
+
+    int payload_len = msg_unpack(frame_buffer, len);
+    if (payload_len == 0) {
+        robot_response((int)(INT16_MAX), "ERROR TRANSMIT");
+        return IDLE;
+    }
+    if ((uint8_t)frame_buffer[0] <= BIN_FRAME_MAX_OPCODE) {
+        return robot_read_binary_command((uint8_t *)frame_buffer, payload_len, id_command, para);
+    }
+    sscanf(frame_buffer, "%d %15s %49c", id_command, command, para);
+    DLOG_I32(DLOG_UART_FRAME, *id_command, payload_len);
+    if (strcmp(command, "SETPOS") == 0) {
+        return SET_POS;
+    } else if (strcmp(command, "SETWID") == 0) {
+        return SET_WID;
+    } else if (strcmp(command, "SETHOME") == 0) {
+        return SET_HOME;
+    } else if (strcmp(command, "SETDUTY") == 0) {
+        return SET_DUTY;
+    } else if (strcmp(command, "SETPOSNARG") == 0) {
+        return SET_POSnARG;
+    } else if (strcmp(command, "SETTIME") == 0) {
+        return SET_TIME;
+    } else if (strcmp(command, "SETWIDPOS") == 0) {
+        return SET_WIDnPOS;
+    } else if (strcmp(command, "SETPOSANGWID") == 0) {
+        return SET_POSnARGnWID;
+    } else if (strcmp(command, "SAVE") == 0 || strcmp(command, "SAVEPOSE") == 0) {
+        return SAVE;
+    } else if (strcmp(command, "GOTO") == 0) {
+        return GOTO;
+    } else if (strcmp(command, "SETIKSEL") == 0) {
+        return SET_IKSEL;
+    } else if (strcmp(command, "SETGRIPPT") == 0) {
+        return SET_GRIPPT;
+    } else if (strcmp(command, "SAVEGRIP") == 0) {
+        return SAVE_GRIP;
+    } else if (strcmp(command, "VALIDATE") == 0) {
+        return VALIDATE;
+    } else if (strcmp(command, "BOOTINFO") == 0) {
+        return BOOTINFO;
+#if CONFIG_ROBOT_TRACE_ENABLE
+    } else if (strcmp(command, "TRACE") == 0) {
+        return TRACE;
+#endif
+#if CONFIG_ROBOT_STATS_ENABLE
+    } else if (strcmp(command, "STATS") == 0) {
+        return STATS;
+#endif
+#if CONFIG_ROBOT_LATENCY_ENABLE
+    } else if (strcmp(command, "LATENCY") == 0) {
+        return LATENCY;
+#endif
+    } else {
+        ESP_LOGE(TAG, "error command: %s", command);
+        robot_response(*id_command, "ERROR COMMAND");
+    }
+    return IDLE;
+}
+
+// commands that publish a trajectory, SET_TIME and SAVE answer through REP without moving
+static bool robot_mode_moves(robot_mode_t frame_mode)
+{
+    switch (frame_mode) {
+    case SET_POS:
+    case SET_WID:
+    case SET_HOME:
+    case SET_DUTY:
+    case SET_POSnARG:
+    case SET_WIDnPOS:
+    case SET_POSnARGnWID:
+    case GOTO:
+        return true;
+    default:
+        return false;
+    }
+}
+
 robot_mode_t robot_read_command(int *id_command, char *para)
 {
-    char buff[100] = {0};
-    int data_len = uart_read_bytes(UART_NUM, (uint8_t *)buff, 50, 1 / portTICK_RATE_MS);
-    if (data_len != 0) {
+    char buff[UART_READ_SIZE];
+    // block for the first byte unless a whole frame is already buffered, then take what the driver holds
+    uint32_t wait = memchr(uart_buffer, 0x7F, uart_buffer_idx) ? 0 : UART_READ_TIMEOUT_MS;
+    int data_len = robot_hal_serial_read((uint8_t *)buff, 1, wait);
+    if (data_len > 0) {
+        int pending = robot_hal_serial_available();
+        if (pending > (int)sizeof(buff) - 1) {
+            pending = sizeof(buff) - 1;
+        }
+        if (pending > 0) {
+            data_len += robot_hal_serial_read((uint8_t *)buff + 1, pending, 0);
+        }
+    }
+    if (data_len > 0) {
         // overflow
-        if (uart_buffer_idx >= BUF_SIZE) {
+        if (uart_buffer_idx + data_len > BUF_SIZE) {
             robot_response((int)(INT16_MAX), "OVERFLOW");
             memset(uart_buffer, 0, BUF_SIZE);
             uart_buffer_idx = 0;
@@ -73,47 +279,24 @@ robot_mode_t robot_read_command(int *id_command, char *para)
         uart_buffer_idx += data_len;
     }
     if (uart_buffer_idx > 0) {
-        char command[10] = {0};
-        int len = 0;
-        while (uart_buffer[len] != 0x7F) {
-            len++;
-        }
-        len++;
-        memset(buff, 0, 50);
-        memmove(buff, uart_buffer, len);
-        // ESP_LOG_BUFFER_HEX("debug, uartbuffer",uart_buffer, data_len);
-        // ESP_LOG_BUFFER_HEX("debug, buff",buff, len);
-        memmove(uart_buffer, uart_buffer + len, BUF_SIZE - len);
-        uart_buffer_idx -= len;
-
-        if (msg_unpack(buff, len) == 0) {
-            robot_response((int)(INT16_MAX), "ERROR TRANSMIT");
-            return IDLE;
+        char *end = memchr(uart_buffer, 0x7F, uart_buffer_idx);
+        if (end == NULL) {
+            return IDLE;     // wait for the rest of the frame
         }
-        sscanf(buff, "%d %s %20c", id_command, command, para);
-        ESP_LOGI(TAG, "buff:%s, para:%s", uart_buffer, para);
-        if (strcmp(command, "SETPOS") == 0) {
-            return SET_POS;
-        } else if (strcmp(command, "SETWID") == 0) {
-            return SET_WID;
-        } else if (strcmp(command, "SETHOME") == 0) {
-            return SET_HOME;
-        } else if (strcmp(command, "SETDUTY") == 0) {
-            return SET_DUTY;
-        } else if (strcmp(command, "SETPOSNARG") == 0) {
-            return SET_POSnARG;
-        } else if (strcmp(command, "SETTIME") == 0) {
-            return SET_TIME;
-        } else if (strcmp(command, "SETWIDPOS") == 0) {
-            return SET_WIDnPOS;
-        } else if (strcmp(command, "SETPOSANGWID") == 0) {
-            return SET_POSnARGnWID;
-        } else if (strcmp(command, "SAVE") == 0) {
-            return SAVE;
-        } else {
-            ESP_LOGE(TAG, "error command: %s", command);
-            robot_response(*id_command, "ERROR COMMAND");
+        int64_t frame_us = esp_timer_get_time();
+        ROBOT_STATS_BEGIN(stamp);
+        robot_mode_t frame_mode = robot_read_frame(end - uart_buffer + 1, id_command, para);
+        ROBOT_STATS_END(ROBOT_STATS_READ_COMMAND, stamp);
+        if (frame_mode != IDLE) {
+            robot_latency_begin(*id_command, frame_us);
+            robot_set_command_id(*id_command);
+            command_moves = robot_mode_moves(frame_mode);
+            if (command_moves) {
+                // only the first one is stamped, FIRST_MOVE ends at its DONE
+                robot_boot_begin(ROBOT_BOOT_FIRST_MOVE);
+            }
         }
+        return frame_mode;
     }
     return IDLE;
 }
@@ -122,29 +305,130 @@ void robot_response(int id_command, char *message)
 {
     char *buff = (char *)calloc(BUF_SIZE, sizeof(char));
     int buff_len = snprintf(buff, BUF_SIZE, "%d:%s", id_command, message);
-    char *temp = (char *)calloc(100, sizeof(char));
+    // worst case every byte is escaped
+    char *temp = (char *)calloc(2 * buff_len + 2, sizeof(char));
     int temp_len = msg_pack(buff, buff_len, temp);
-    uart_write_bytes(UART_NUM, temp, temp_len);
+    robot_hal_serial_write((uint8_t *)temp, temp_len);
     free(temp);
     free(buff);
 }
 
+void robot_response_binary(uint8_t *payload, int payload_len)
+{
+    char *temp = (char *)calloc(2 * payload_len + 2, sizeof(char));
+    int temp_len = msg_pack((char *)payload, payload_len, temp);
+    robot_hal_serial_write((uint8_t *)temp, temp_len);
+    free(temp);
+}
+
+// stream the stopped trace as binary chunks of TRACE_CHUNK_RECORD records, chunk and chunk num are u16
+static void robot_trace_dump(int id_command)
+{
+    int count = robot_trace_count();
+    int chunk_num = (count + TRACE_CHUNK_RECORD - 1) / TRACE_CHUNK_RECORD;
+    uint8_t *payload = (uint8_t *)calloc(1, 7 + TRACE_CHUNK_RECORD * sizeof(robot_trace_record_t));
+    if (payload == NULL) {
+        robot_response(id_command, "ERROR");
+        return;
+    }
+    for (int chunk = 0; chunk < chunk_num; chunk++) {
+        int num = robot_trace_read(chunk * TRACE_CHUNK_RECORD, (robot_trace_record_t *)(payload + 7),
+                                   TRACE_CHUNK_RECORD);
+        payload[0] = BIN_OPCODE_TRACE | BIN_OPCODE_RESPONSE;
+        payload[1] = id_command;
+        payload[2] = chunk & 0xFF;
+        payload[3] = chunk >> 8;
+        payload[4] = chunk_num & 0xFF;
+        payload[5] = chunk_num >> 8;
+        payload[6] = num;
+        robot_response_binary(payload, 7 + num * sizeof(robot_trace_record_t));
+    }
+    free(payload);
+}
+
+#if CONFIG_ROBOT_LATENCY_ENABLE
+// one response line per interval of the command lifecycle
+static void robot_latency_report(int id_command)
+{
+    char line[160];
+    for (int i = 0; robot_latency_format(i, line, sizeof(line)) > 0; i++) {
+        robot_response(id_command, line);
+    }
+}
+#endif
+
+// DONE of a motion command, closes its latency record
+static void robot_response_done(int id_command)
+{
+#if CONFIG_ROBOT_LATENCY_ENABLE
+    if (latency_append) {
+        char line[96];
+        int len = snprintf(line, sizeof(line), "DONE ");
+        robot_latency_format_last(line + len, sizeof(line) - len);
+        robot_response(id_command, line);
+        robot_latency_done(id_command);
+        if (command_moves) {
+            robot_boot_end(ROBOT_BOOT_FIRST_MOVE);
+        }
+        return;
+    }
+#endif
+    robot_response(id_command, "DONE");
+    robot_latency_done(id_command);
+    if (command_moves) {
+        robot_boot_end(ROBOT_BOOT_FIRST_MOVE);
+    }
+}
+
+// one response line per boot stage reached
+static void robot_boot_report(int id_command)
+{
+    char line[96];
+    for (int i = 0; robot_boot_format(i, line, sizeof(line)) > 0; i++) {
+        robot_response(id_command, line);
+    }
+}
+
+// one response line per counter, deadline and ik cache counters last
+static void robot_stats_report(int id_command)
+{
+    char line[160];
+    for (int i = 0; robot_stats_format(i, line, sizeof(line)) > 0; i++) {
+        robot_response(id_command, line);
+    }
+    robot_tick_stats_t tick_stats;
+    robot_get_tick_stats(&tick_stats);
+    snprintf(line, sizeof(line), "STATS DEADLINE n=%u late=%u missed=%u dropped=%u worst=%u us", tick_stats.tick,
+             tick_stats.late, tick_stats.missed, tick_stats.dropped, tick_stats.worst_late_us);
+    robot_response(id_command, line);
+    ik_cache_stats_t ik_stats;
+    if (robot_get_ik_cache_stats(&ik_stats) == ESP_OK) {
+        snprintf(line, sizeof(line), "STATS IKCACHE hit=%u miss=%u invalidate=%u", ik_stats.hit, ik_stats.miss,
+                 ik_stats.invalidate);
+        robot_response(id_command, line);
+    }
+}
+
 static void uart_task(void *pv)
 {
     ESP_LOGI(TAG, "uart_task starting ...");
-    uart_config_t uart_config = {.baud_rate = 115200,
-                                 .data_bits = UART_DATA_8_BITS,
-                                 .parity = UART_PARITY_DISABLE,
-                                 .stop_bits = UART_STOP_BITS_1,
-                                 .flow_ctrl = UART_HW_FLOWCTRL_DISABLE};
-    uart_param_config(UART_NUM, &uart_config);
-    uart_set_pin(UART_NUM, UART_TXD_PINNUM, UART_RXD_PINNUM, UART_RTS_PINNUM, UART_CTS_PINNUM);
-    uart_driver_install(UART_NUM, BUF_SIZE * 2, 0, 0, NULL, 0);
+    robot_boot_begin(ROBOT_BOOT_UART);
+    robot_hal_serial_init(UART_BAUD_RATE, BUF_SIZE * 2);
+    robot_boot_end(ROBOT_BOOT_UART);
+    robot_stats_add_task(xTaskGetCurrentTaskHandle());
+    // frames sent before READY wait in the driver rx buffer
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    robot_boot_end(ROBOT_BOOT_READY);
+    robot_response((int)(INT16_MAX), "READY");
     int id_command = 0;
     char para[50];
-    double x, y, z, width;
+    double x, y, z, width, len;
     double angle;
-    int duty, channel, time;
+    int duty, channel, time, pose, select_mode, idx;
+    robot_ik_select_t ik_select;
+    robot_target_t target;
+    robot_validate_result_t result;
+    esp_err_t err;
     while (1) {
         switch (mode) {
         case IDLE:
@@ -172,9 +456,13 @@ static void uart_task(void *pv)
             }
             break;
         case SET_HOME:
-            robot_set_home();
-            robot_response(id_command, "PROCESSING");
-            mode = REP;
+            if (robot_set_home() == ESP_OK) {
+                robot_response(id_command, "PROCESSING");
+                mode = REP;
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
+                mode = IDLE;
+            }
             break;
         case SET_DUTY:
             sscanf(para, "%d %d", &duty, &channel);
@@ -227,22 +515,132 @@ static void uart_task(void *pv)
             }
             break;
         case SAVE:
-            // robot_save();
-            robot_response(id_command, "PROCESSING");
-            mode = REP;
+            if (sscanf(para, "%d", &pose) == 1 && robot_pose_save(pose) == ESP_OK) {
+                robot_response(id_command, "PROCESSING");
+                mode = REP;
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
+                mode = IDLE;
+            }
             break;
-        case REP:
-            if (robot_get_status() == SERVO_STATUS_IDLE) {
+        case GOTO:
+            if (sscanf(para, "%d", &pose) == 1 && robot_pose_goto(pose) == ESP_OK) {
+                robot_response(id_command, "PROCESSING");
+                mode = REP;
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
+                mode = IDLE;
+            }
+            break;
+        case SET_IKSEL:
+            robot_get_ik_select(&ik_select);
+            select_mode = -1;
+            sscanf(para, "%d", &select_mode);
+            ik_select.mode = (robot_ik_select_mode_t)select_mode;
+            if (robot_set_ik_select(&ik_select) == ESP_OK) {
+                robot_response(id_command, "DONE");
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
+            }
+            mode = IDLE;
+            break;
+        case SET_GRIPPT:
+            if (sscanf(para, "%d %lf %d %lf", &idx, &width, &duty, &len) == 4 &&
+                robot_set_gripper_point(idx, width, duty, len) == ESP_OK) {
+                robot_response(id_command, "DONE");
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
+            }
+            mode = IDLE;
+            break;
+        case SAVE_GRIP:
+            if (sscanf(para, "%d", &idx) == 1 && robot_save_gripper_model(idx) == ESP_OK) {
                 robot_response(id_command, "DONE");
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
+            }
+            mode = IDLE;
+            break;
+        case VALIDATE:
+            memset(&target, 0, sizeof(target));
+            if (sscanf(para, "%d %lf %lf %lf %lf %lf", &idx, &target.x, &target.y, &target.z, &target.angle,
+                       &target.width) >= 4) {
+                target.kind = (robot_target_kind_t)idx;
+                robot_validate(&target, 1, &result);
+                if (result.reachable) {
+                    snprintf(para, sizeof(para), "OK %d %d %d %d %d %d %d", result.duty[0], result.duty[1],
+                             result.duty[2], result.duty[3], result.duty[4], result.duty[5], result.duration);
+                    robot_response(id_command, para);
+                } else {
+                    robot_response(id_command, "UNREACHABLE");
+                }
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
+            }
+            mode = IDLE;
+            break;
+        case TRACE:
+            if (strncmp(para, "START", 5) == 0) {
+                robot_trace_start();
+            } else if (strncmp(para, "STOP", 4) == 0) {
+                robot_trace_stop();
+            } else if (strncmp(para, "TRIGGER", 7) == 0) {
+                idx = 0;
+                sscanf(para + 7, "%d", &idx);
+                robot_trace_arm(idx);
+            } else if (strncmp(para, "DUMP", 4) == 0) {
+                robot_trace_stop();
+                robot_trace_dump(id_command);
+            } else {
+                robot_response(id_command, "ERROR ARGUMENT");
                 mode = IDLE;
-            } else if (robot_get_status() == SERVO_STATUS_ERROR) {
+                break;
+            }
+            robot_response(id_command, "DONE");
+            mode = IDLE;
+            break;
+        case STATS:
+            if (strncmp(para, "RESET", 5) == 0) {
+                robot_stats_reset();
+                robot_reset_tick_stats();
+            } else {
+                robot_stats_report(id_command);
+            }
+            robot_response(id_command, "DONE");
+            mode = IDLE;
+            break;
+#if CONFIG_ROBOT_LATENCY_ENABLE
+        case LATENCY:
+            if (strncmp(para, "RESET", 5) == 0) {
+                robot_latency_reset();
+            } else if (strncmp(para, "APPEND", 6) == 0) {
+                latency_append = strstr(para + 6, "ON") != NULL;
+            } else {
+                robot_latency_report(id_command);
+            }
+            robot_response(id_command, "DONE");
+            mode = IDLE;
+            break;
+#endif
+        case BOOTINFO:
+            robot_boot_report(id_command);
+            robot_response(id_command, "DONE");
+            mode = IDLE;
+            break;
+        case REP:
+            // woken by the motion task when the move ends, no polling
+            err = robot_wait_done(REP_WAIT_MS);
+            if (err == ESP_OK) {
+                robot_response_done(id_command);
+                mode = IDLE;
+            } else if (err == ESP_FAIL) {
                 robot_response(id_command, "ERROR");
+                mode = IDLE;
             }
             break;
         default:
             break;
         }
-        vTaskDelay(20 / portTICK_RATE_MS);
     }
 }
 
@@ -250,8 +648,17 @@ void app_main(void)
 {
     esp_log_level_set("*", ESP_LOG_INFO);
     esp_log_level_set(TAG, ESP_LOG_DEBUG);
+    robot_boot_end(ROBOT_BOOT_APP_MAIN);
 
-    servo_init();     // start timer and servo run task
+    // uart driver isr is installed from uart_task, so it follows the task to the command core.
+    // it is created first and waits for the notify to take commands. With the default layout it shares the
+    // core of app_main, so at its higher priority the install runs before the flash load, not alongside it
+    TaskHandle_t uart_handle = NULL;
+    xTaskCreatePinnedToCore(uart_task, "UART-TASK", 8 * 1024, NULL, ROBOT_COMM_TASK_PRIORITY, &uart_handle,
+                            ROBOT_COMM_TASK_CORE);
 
-    xTaskCreate(uart_task, "UART-TASK", 8 * 1024, NULL, 6, NULL);
+    servo_init();     // start timer and servo run task
+    robot_pose_init(servo_nvs_get_storage());
+    robot_boot_end(ROBOT_BOOT_STORAGE);
+    xTaskNotifyGive(uart_handle);
 }
@@ -0,0 +1,127 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "dlog.h"
+
+static const char *TAG = "DLOG";
+
+#ifdef CONFIG_ROBOT_DLOG_RING_SIZE
+#define DLOG_RING_SIZE CONFIG_ROBOT_DLOG_RING_SIZE
+#else
+#define DLOG_RING_SIZE (64)     // records per module, power of 2
+#endif
+_Static_assert((DLOG_RING_SIZE & (DLOG_RING_SIZE - 1)) == 0, "DLOG_RING_SIZE must be a power of 2");
+
+#define DLOG_FLUSH_MS (50)
+#define DLOG_LINE_SIZE (128)
+
+typedef enum {
+    DLOG_TYPE_I32 = 0,
+    DLOG_TYPE_F32,
+} dlog_type_t;
+
+typedef struct {
+    uint32_t stamp;             // us, low 32 bits of esp_timer
+    uint16_t id;
+    uint16_t argc;
+    uint32_t arg[DLOG_ARG_MAX];
+} dlog_record_t;
+
+typedef struct {
+    dlog_record_t record[DLOG_RING_SIZE];
+    volatile uint32_t head;     // written by the producer only
+    volatile uint32_t tail;     // written by the formatter only
+    volatile uint32_t dropped;
+} dlog_ring_t;
+
+typedef struct {
+    uint8_t module;
+    uint8_t level;
+    uint8_t type;
+    const char *format;
+} dlog_format_t;
+
+#define DLOG_X_FORMAT(id, module, level, type, format) \
+    [id] = {DLOG_MODULE_##module, DLOG_LEVEL_##level, DLOG_TYPE_##type, format},
+static const dlog_format_t dlog_format[DLOG_ID_MAX] = {DLOG_FORMAT_TABLE(DLOG_X_FORMAT)};
+
+static const char *dlog_module_tag[DLOG_MODULE_MAX] = {"MOTION", "PLAN", "UART"};
+static dlog_ring_t dlog_ring[DLOG_MODULE_MAX];
+
+void dlog_write(dlog_id_t id, const void *arg, int argc)
+{
+    dlog_ring_t *ring = &dlog_ring[dlog_format[id].module];
+    uint32_t head = ring->head;
+    if (head - ring->tail >= DLOG_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    dlog_record_t *record = &ring->record[head % DLOG_RING_SIZE];
+    record->stamp = (uint32_t)esp_timer_get_time();
+    record->id = id;
+    record->argc = argc > DLOG_ARG_MAX ? DLOG_ARG_MAX : argc;
+    memcpy(record->arg, arg, record->argc * sizeof(uint32_t));
+    // record must be visible before the formatter sees the new head
+    __sync_synchronize();
+    ring->head = head + 1;
+}
+
+static void dlog_print(const dlog_record_t *record, const char *tag)
+{
+    char line[DLOG_LINE_SIZE];
+    const dlog_format_t *format = &dlog_format[record->id];
+    uint32_t a[DLOG_ARG_MAX] = {0};
+    memcpy(a, record->arg, record->argc * sizeof(uint32_t));
+    // every argument of a format has the same type, unused ones are ignored by snprintf
+    if (format->type == DLOG_TYPE_F32) {
+        float f[DLOG_ARG_MAX];
+        memcpy(f, a, sizeof(f));
+        snprintf(line, sizeof(line), format->format, (double)f[0], (double)f[1], (double)f[2], (double)f[3],
+                 (double)f[4], (double)f[5]);
+    } else {
+        snprintf(line, sizeof(line), format->format, (int)a[0], (int)a[1], (int)a[2], (int)a[3], (int)a[4],
+                 (int)a[5]);
+    }
+    esp_log_write((esp_log_level_t)format->level, tag, "%c (%u) %s: %s\n", " EWID"[format->level],
+                  record->stamp / 1000, tag, line);
+}
+
+static void dlog_task(void *arg)
+{
+    uint32_t dropped[DLOG_MODULE_MAX] = {0};
+    while (1) {
+        for (int m = 0; m < DLOG_MODULE_MAX; m++) {
+            dlog_ring_t *ring = &dlog_ring[m];
+            while (ring->tail != ring->head) {
+                __sync_synchronize();
+                dlog_print(&ring->record[ring->tail % DLOG_RING_SIZE], dlog_module_tag[m]);
+                __sync_synchronize();
+                ring->tail++;
+            }
+            if (ring->dropped != dropped[m]) {
+                ESP_LOGW(TAG, "%s: %u records dropped", dlog_module_tag[m], ring->dropped - dropped[m]);
+                dropped[m] = ring->dropped;
+            }
+        }
+        vTaskDelay(DLOG_FLUSH_MS / portTICK_RATE_MS);
+    }
+}
+
+esp_err_t dlog_init(int core, int priority)
+{
+    if (xTaskCreatePinnedToCore(dlog_task, "DLOG-TASK", 4 * 1024, NULL, priority, NULL, core) != pdPASS) {
+        ESP_LOGE(TAG, "Error create task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,99 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _DLOG_H_
+#define _DLOG_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "dlog_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Deferred logging. A hot path stores a format id and raw 32 bit arguments in the
+ * ring of its module, formatting is done later by a low priority task.
+ * Each module is written from one task only, so every ring is single producer / single consumer
+ */
+
+#define DLOG_ARG_MAX (6)
+
+#define DLOG_LEVEL_NONE (0)
+#define DLOG_LEVEL_ERROR (1)     // same values as esp_log_level_t
+#define DLOG_LEVEL_WARN (2)
+#define DLOG_LEVEL_INFO (3)
+#define DLOG_LEVEL_DEBUG (4)
+
+// compile time level of each module, formats above it are compiled out
+#ifdef CONFIG_ROBOT_DLOG_LEVEL_MOTION
+#define DLOG_LEVEL_MOTION CONFIG_ROBOT_DLOG_LEVEL_MOTION
+#else
+#define DLOG_LEVEL_MOTION DLOG_LEVEL_WARN
+#endif
+
+#ifdef CONFIG_ROBOT_DLOG_LEVEL_PLAN
+#define DLOG_LEVEL_PLAN CONFIG_ROBOT_DLOG_LEVEL_PLAN
+#else
+#define DLOG_LEVEL_PLAN DLOG_LEVEL_INFO
+#endif
+
+#ifdef CONFIG_ROBOT_DLOG_LEVEL_UART
+#define DLOG_LEVEL_UART CONFIG_ROBOT_DLOG_LEVEL_UART
+#else
+#define DLOG_LEVEL_UART DLOG_LEVEL_INFO
+#endif
+
+typedef enum {
+    DLOG_MODULE_MOTION = 0,     // motion task: tick, lspb, mcpwm
+    DLOG_MODULE_PLAN,           // command task: robot_set_*, ik
+    DLOG_MODULE_UART,           // command task: frame reader
+    DLOG_MODULE_MAX,
+} dlog_module_t;
+
+#define DLOG_X_ID(id, module, level, type, format) id,
+typedef enum {
+    DLOG_FORMAT_TABLE(DLOG_X_ID)
+    DLOG_ID_MAX,
+} dlog_id_t;
+
+#define DLOG_X_ON(id, module, level, type, format) id##_ON = (DLOG_LEVEL_##level <= DLOG_LEVEL_##module),
+enum {
+    DLOG_FORMAT_TABLE(DLOG_X_ON)
+};
+
+/**
+ * Start the formatter task, records written before are kept
+ */
+esp_err_t dlog_init(int core, int priority);
+
+/**
+ * Copy argc 32 bit arguments into the ring of the module of id, dropped and counted if the ring is full
+ */
+void dlog_write(dlog_id_t id, const void *arg, int argc);
+
+#define DLOG_I32(id, ...)                                                                                        \
+    do {                                                                                                         \
+        if (id##_ON) {                                                                                           \
+            const int32_t _dlog_arg[] = {__VA_ARGS__};                                                           \
+            dlog_write(id, _dlog_arg, sizeof(_dlog_arg) / sizeof(int32_t));                                      \
+        }                                                                                                        \
+    } while (0)
+
+#define DLOG_F32(id, ...)                                                                                        \
+    do {                                                                                                         \
+        if (id##_ON) {                                                                                           \
+            const float _dlog_arg[] = {__VA_ARGS__};                                                             \
+            dlog_write(id, _dlog_arg, sizeof(_dlog_arg) / sizeof(float));                                        \
+        }                                                                                                        \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
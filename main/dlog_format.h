@@ -0,0 +1,55 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _DLOG_FORMAT_H_
+#define _DLOG_FORMAT_H_
+
+/*
+ * Deferred log formats, X(id, module, level, type, format)
+ * type is the type of every argument (I32 or F32), at most DLOG_ARG_MAX arguments.
+ * Ids are sent on the wire by value, only append new formats at the end of a module
+ */
+#define DLOG_FORMAT_TABLE(X)                                                                                     \
+    X(DLOG_SERVO_RUN, MOTION, DEBUG, I32, "EVENT SERVO RUN seq: %d")                                             \
+    X(DLOG_LSPB_CALC, MOTION, DEBUG, F32, "a: %.1f, P0: %.0f, Pf: %.0f, tf: %.0f, tb: %.0f")                   \
+    X(DLOG_LSPB_TIME_ZERO, MOTION, ERROR, F32, "tf:%.1f or tb:%.1f input is under zero")                       \
+    X(DLOG_LSPB_TIME_ORDER, MOTION, ERROR, F32, "tf:%.1f must be > tb:%.1f")                                    \
+    X(DLOG_PLANNING_A_ZERO, MOTION, WARN, F32, "warning input: a = %.2f")                                       \
+    X(DLOG_PLANNING_T_ERROR, MOTION, ERROR, F32, "error T %.0f")                                                \
+    X(DLOG_PLANNING_PHASE, MOTION, DEBUG, I32, "phase: %d, time_count: %d")                                     \
+    X(DLOG_SET_DUTY_STEP, MOTION, DEBUG, I32, "channel: %d, step: %d, time_count: %d")                          \
+    X(DLOG_SET_DUTY_ERROR, MOTION, ERROR, I32, "servo status ERROR, channel: %d")                               \
+    X(DLOG_STATUS_ERROR, MOTION, ERROR, I32, "argument is available. , duty current: %d , duty target: %d")     \
+    X(DLOG_STATUS_IDLE, MOTION, DEBUG, I32, "CHANNEL SERVO IS IDLE: %d")                                        \
+    X(DLOG_DUTY_FORCE, MOTION, ERROR, I32, "force duty is %d ")                                                \
+    X(DLOG_MCPWM_ERROR, MOTION, ERROR, I32, "error unit: %d")                                                   \
+    X(DLOG_MCPWM_CURRENT, MOTION, DEBUG, I32, "current %d     %d     %d     %d     %d")                         \
+    X(DLOG_MCPWM_TARGET, MOTION, DEBUG, I32, "target  %d     %d     %d     %d     %d")                          \
+    X(DLOG_SERVO_WAKE, MOTION, DEBUG, I32, "EVENT SERVO WAKE seq: %d")                                          \
+    X(DLOG_SET_POSITION, PLAN, INFO, F32, "position set: x: %.2f, y: %.2f, z: %.2f")                            \
+    X(DLOG_SET_POSITION_ANGLE, PLAN, INFO, F32, "position set: x: %.2f, y: %.2f, z: %.2f / angle set: %.2f")    \
+    X(DLOG_SET_WIDTH, PLAN, INFO, F32, "width set: %.1f")                                                       \
+    X(DLOG_PLAN_CHANNEL, PLAN, DEBUG, I32, "servo %d set duty: %d us")                                          \
+    X(DLOG_IK_CACHE_HIT, PLAN, DEBUG, I32, "ik cache hit, kind: %d")                                            \
+    X(DLOG_IK_THETA, PLAN, INFO, F32, "theta[1]: %.0f, cost: %.2f")                                             \
+    X(DLOG_IK_THETA_RAW, PLAN, DEBUG, F32,                                                                       \
+      "theta:  theta[0]: %.2f, theta[1]: %.2f, theta[2]: %.2f, theta[3]: %.2f, theta[4]: %.2f")                  \
+    X(DLOG_IK_THETA_ANGLE, PLAN, INFO, F32,                                                                      \
+      "theta:  theta[0]: %.2f, theta[1]: %.2f, theta[2]: %.2f, theta[3]: %.2f, theta[4]: %.2f")                  \
+    X(DLOG_IK_THETA_SCALED, PLAN, DEBUG, F32,                                                                    \
+      "scale off: theta[0]: %.2f, theta[1]: %.2f, theta[2]: %.2f, theta[3]: %.2f, theta[4]: %.2f")               \
+    X(DLOG_IK_THETA_INVALID, PLAN, DEBUG, I32, "theta [%d] == -1")                                              \
+    X(DLOG_IK_DUTY, PLAN, INFO, I32, "duty : duty[0]: %d, duty[1]: %d, duty[2]: %d, duty[3]: %d, duty[4]: %d") \
+    X(DLOG_IK_OUT_OF_WORKSPACE, PLAN, ERROR, F32, "position is out of workspace, d: %.2f, z: %.2f")            \
+    X(DLOG_IK_ANGLE_REACH, PLAN, ERROR, F32, "a23 %.2f > a2 + a3 %.2f")                                         \
+    X(DLOG_IK_ANGLE_BETA, PLAN, ERROR, F32, "beta %.2f  < 90")                                                 \
+    X(DLOG_IK_ANGLE_THETA_INVALID, PLAN, ERROR, I32, "theta [%d] == -1")                                       \
+    X(DLOG_TARGET_WIDTH, PLAN, ERROR, F32, "width %.2f is not available")                                      \
+    X(DLOG_TARGET_KIND, PLAN, ERROR, I32, "target kind %d is not available")                                   \
+    X(DLOG_GRIPPER_WIDTH_RANGE, PLAN, ERROR, F32, "width is: %.2f out of range [%.2f:%.2f]")                    \
+    X(DLOG_UART_FRAME, UART, INFO, I32, "frame id: %d, len: %d")
+
+#endif
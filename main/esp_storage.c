@@ -3,6 +3,7 @@
  * the license was not distributed with this file, you can obtain one at:
  *                             ./LICENSE
  */
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,19 +12,28 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 
-#include "nvs_flash.h"
-#include "nvs.h"
 #include "esp_storage.h"
+#include "robot_hal.h"
 
 static const char *TAG = "ESP_STORAGE";
 
+#define STORAGE_HASH_SIZE (16)     // buckets, power of 2
+
 typedef struct esp_storage_item {
     storage_unpack_func         unpack;
     storage_pack_func           pack;
+    storage_written_func        written;
     char*                           key;
+    uint32_t                        hash;           // of the lower case key
     void*                           context;
+    char*                           pending;        // write behind snapshot
+    int                             pending_len;
+    bool                            dirty;
+    bool                            writing;        // set in this write, waiting for the commit, write_lock
+    struct esp_storage_item*        hash_next;
     STAILQ_ENTRY(esp_storage_item)  next;
 } esp_storage_item_t;
 
@@ -31,16 +41,158 @@ struct esp_storage_t {
     char*                                           namespace;
     int                                             buffer_size;
     char*                                           buffer;
-    SemaphoreHandle_t                               lock;
+    robot_hal_lock_t                                lock;
     STAILQ_HEAD(esp_storage_list, esp_storage_item) list;
+    esp_storage_item_t*                             bucket[STORAGE_HASH_SIZE];
+    robot_hal_kv_t                                  kv;             // opened on first use, closed by destroy
+    bool                                            write_behind;
+    int                                             coalesce_ms;
+    char*                                           write_buffer;   // snapshot being written, write_lock
+    robot_hal_lock_t                                write_lock;     // one writer of pending snapshots
+    TaskHandle_t                                    task;
+    volatile bool                                   task_exit;
+    SemaphoreHandle_t                               task_done;      // given by the task as it exits
 };
 
 #define DEFAULT_STORAGE_BUFFER (1024)
+#define DEFAULT_STORAGE_TASK_PRIORITY (1)
+#define DEFAULT_STORAGE_COALESCE_MS (200)
+
+#define _mutex_lock(x)       robot_hal_lock(x)
+#define _mutex_unlock(x)     robot_hal_unlock(x)
+#define _mutex_create()      robot_hal_lock_create()
+#define _mutex_destroy(x)    robot_hal_lock_destroy(x)
+
+// fnv-1a of the lower case key, keys are matched with strcasecmp
+static uint32_t esp_storage_hash(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*key++)) * 16777619u;
+    }
+    return hash;
+}
+
+// the namespace stays open, kv handles are safe to share between tasks
+static esp_err_t esp_storage_open(esp_storage_handle_t storage)
+{
+    if (storage->kv) {
+        return ESP_OK;
+    }
+    esp_err_t err = robot_hal_kv_open(storage->namespace, &storage->kv);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error open %s: %d", storage->namespace, err);
+        return err;
+    }
+    return ESP_OK;
+}
+
+// pack an item into storage->buffer, must be called with lock, return the packed size or 0
+static int esp_storage_pack(esp_storage_handle_t storage, esp_storage_item_t *item)
+{
+    int write_size = item->pack(item->context, storage->buffer, storage->buffer_size);
+    if (write_size <= 0) {
+        ESP_LOGE(TAG, "Error save configuration %s", item->key);
+        return 0;
+    }
+    return write_size;
+}
 
-#define _mutex_lock(x)       while (xSemaphoreTake(x, portMAX_DELAY) != pdPASS);
-#define _mutex_unlock(x)     xSemaphoreGive(x)
-#define _mutex_create()      xSemaphoreCreateMutex()
-#define _mutex_destroy(x)    vSemaphoreDelete(x)
+// keep the packed buffer as the snapshot of the item, a newer snapshot replaces one not written yet
+static esp_err_t esp_storage_snapshot(esp_storage_handle_t storage, esp_storage_item_t *item, int write_size)
+{
+    if (item->pending == NULL || item->pending_len != write_size) {
+        char *pending = realloc(item->pending, write_size);
+        if (pending == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        item->pending = pending;
+    }
+    memcpy(item->pending, storage->buffer, write_size);
+    item->pending_len = write_size;
+    item->dirty = true;
+    return ESP_OK;
+}
+
+// write every dirty snapshot with one commit, the item lock is only held to copy one out so saves never
+// wait for flash
+static esp_err_t esp_storage_write_pending(esp_storage_handle_t storage)
+{
+    esp_err_t result = ESP_OK;
+    int written = 0;
+    esp_storage_item_t *item;
+    _mutex_lock(storage->write_lock);
+    _mutex_lock(storage->lock);
+    result = esp_storage_open(storage);
+    _mutex_unlock(storage->lock);
+    if (result != ESP_OK) {
+        _mutex_unlock(storage->write_lock);
+        return result;
+    }
+    STAILQ_FOREACH(item, &storage->list, next) {
+        _mutex_lock(storage->lock);
+        if (item->dirty == false) {
+            _mutex_unlock(storage->lock);
+            continue;
+        }
+        int len = item->pending_len;
+        memcpy(storage->write_buffer, item->pending, len);
+        item->dirty = false;
+        _mutex_unlock(storage->lock);
+        esp_err_t err = robot_hal_kv_set(storage->kv, item->key, storage->write_buffer, len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error write %s: %d", item->key, err);
+            _mutex_lock(storage->lock);
+            item->dirty = true;     // kept for the next save or flush, unless a newer snapshot replaced it
+            _mutex_unlock(storage->lock);
+            if (item->written) {
+                item->written(item->context, err);
+            }
+            result = err;
+            continue;
+        }
+        item->writing = true;
+        written++;
+    }
+    esp_err_t commit = ESP_OK;
+    if (written > 0) {
+        commit = robot_hal_kv_commit(storage->kv);
+        if (commit != ESP_OK) {
+            ESP_LOGE(TAG, "Error commit: %d", commit);
+            result = commit;
+        }
+    }
+    STAILQ_FOREACH(item, &storage->list, next) {
+        if (item->writing == false) {
+            continue;
+        }
+        item->writing = false;
+        if (commit != ESP_OK) {
+            _mutex_lock(storage->lock);
+            item->dirty = true;
+            _mutex_unlock(storage->lock);
+        }
+        if (item->written) {
+            item->written(item->context, commit);
+        }
+    }
+    _mutex_unlock(storage->write_lock);
+    return result;
+}
+
+static void esp_storage_task(void *arg)
+{
+    esp_storage_handle_t storage = (esp_storage_handle_t)arg;
+    while (storage->task_exit == false) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // saves arriving in the window only replace the snapshot, the key is written once
+        vTaskDelay(storage->coalesce_ms / portTICK_RATE_MS);
+        ulTaskNotifyTake(pdTRUE, 0);
+        esp_storage_write_pending(storage);
+    }
+    xSemaphoreGive(storage->task_done);
+    vTaskDelete(NULL);
+}
 
 esp_storage_handle_t esp_storage_init(esp_storage_config_t *config)
 {
@@ -70,13 +222,37 @@ esp_storage_handle_t esp_storage_init(esp_storage_config_t *config)
         goto _storage_init_failed;
     }
     STAILQ_INIT(&storage->list);
+    if (config->write_behind) {
+        storage->write_behind = true;
+        storage->coalesce_ms = config->coalesce_ms > 0 ? config->coalesce_ms : DEFAULT_STORAGE_COALESCE_MS;
+        storage->write_buffer = malloc(storage->buffer_size);
+        storage->write_lock = _mutex_create();
+        storage->task_done = xSemaphoreCreateBinary();
+        if (storage->write_buffer == NULL || storage->write_lock == NULL || storage->task_done == NULL) {
+            ESP_LOGE(TAG, "Error create write behind buffer");
+            goto _storage_init_failed;
+        }
+        int priority = config->task_priority > 0 ? config->task_priority : DEFAULT_STORAGE_TASK_PRIORITY;
+        if (xTaskCreatePinnedToCore(esp_storage_task, "STORAGE-TASK", 3 * 1024, storage, priority, &storage->task,
+                                    config->task_core) != pdPASS) {
+            ESP_LOGE(TAG, "Error create task");
+            goto _storage_init_failed;
+        }
+    }
     return storage;
 _storage_init_failed:
     free(storage->buffer);
+    free(storage->write_buffer);
     free(storage->namespace);
     if (storage->lock) {
         _mutex_destroy(storage->lock);
     }
+    if (storage->write_lock) {
+        _mutex_destroy(storage->write_lock);
+    }
+    if (storage->task_done) {
+        vSemaphoreDelete(storage->task_done);
+    }
     free(storage);
     return NULL;
 }
@@ -86,28 +262,48 @@ esp_err_t esp_storage_destroy(esp_storage_handle_t storage)
     if (storage == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
+    // the task writes what is pending and exits on its own, it may hold write_lock until then
+    if (storage->task) {
+        storage->task_exit = true;
+        xTaskNotifyGive(storage->task);
+        xSemaphoreTake(storage->task_done, portMAX_DELAY);
+        esp_storage_flush(storage);
+    }
     esp_storage_item_t *item = STAILQ_FIRST(&storage->list);
     esp_storage_item_t *tmp;
     while (item != NULL) {
         tmp = STAILQ_NEXT(item, next);
         free(item->key);
+        free(item->pending);
         free(item);
         item = tmp;
     }
+    if (storage->kv) {
+        robot_hal_kv_close(storage->kv);
+    }
     free(storage->buffer);
+    free(storage->write_buffer);
     free(storage->namespace);
     if (storage->lock) {
         _mutex_destroy(storage->lock);
     }
-    storage = NULL;
+    if (storage->write_lock) {
+        _mutex_destroy(storage->write_lock);
+    }
+    if (storage->task_done) {
+        vSemaphoreDelete(storage->task_done);
+    }
+    free(storage);
     return ESP_OK;
 }
 
+// must be called with lock
 static esp_storage_item_t* esp_storage_get_item_by_key(esp_storage_handle_t storage, const char *key)
 {
-    esp_storage_item_t *item;
-    STAILQ_FOREACH(item, &storage->list, next) {
-        if (strcasecmp(item->key, key) == 0) {
+    uint32_t hash = esp_storage_hash(key);
+    esp_storage_item_t *item = storage->bucket[hash & (STORAGE_HASH_SIZE - 1)];
+    for (; item != NULL; item = item->hash_next) {
+        if (item->hash == hash && strcasecmp(item->key, key) == 0) {
             return item;
         }
     }
@@ -119,11 +315,7 @@ esp_err_t esp_storage_add(esp_storage_handle_t storage, const char *key, storage
     if (storage == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
-    esp_storage_item_t *item = esp_storage_get_item_by_key(storage, key);
-    if (item != NULL) {
-        return ESP_FAIL;
-    }
-    item = calloc(1, sizeof(esp_storage_item_t));
+    esp_storage_item_t *item = calloc(1, sizeof(esp_storage_item_t));
     if (item == NULL) {
         return ESP_ERR_NO_MEM;
     }
@@ -132,109 +324,195 @@ esp_err_t esp_storage_add(esp_storage_handle_t storage, const char *key, storage
         free(item);
         return ESP_ERR_NO_MEM;
     }
+    item->hash = esp_storage_hash(key);
     item->unpack = unpack;
     item->pack = pack;
     item->context = context;
+    _mutex_lock(storage->lock);
+    if (esp_storage_get_item_by_key(storage, key) != NULL) {
+        _mutex_unlock(storage->lock);
+        free(item->key);
+        free(item);
+        return ESP_FAIL;
+    }
+    esp_storage_item_t **bucket = &storage->bucket[item->hash & (STORAGE_HASH_SIZE - 1)];
+    item->hash_next = *bucket;
+    *bucket = item;
     STAILQ_INSERT_TAIL(&storage->list, item, next);
+    _mutex_unlock(storage->lock);
     return ESP_OK;
 }
 
+esp_err_t esp_storage_set_written(esp_storage_handle_t storage, const char *key, storage_written_func written)
+{
+    if (storage == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(storage->lock);
+    esp_storage_item_t *item = esp_storage_get_item_by_key(storage, key);
+    if (item != NULL) {
+        item->written = written;
+    }
+    _mutex_unlock(storage->lock);
+    return item != NULL ? ESP_OK : ESP_FAIL;
+}
+
 esp_err_t esp_storage_remove(esp_storage_handle_t storage, const char *key)
 {
     if (storage == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
+    // the write behind writer walks the list, it must not see the item go
+    if (storage->write_lock) {
+        _mutex_lock(storage->write_lock);
+    }
+    _mutex_lock(storage->lock);
     esp_storage_item_t *item = esp_storage_get_item_by_key(storage, key);
     if (item == NULL) {
+        _mutex_unlock(storage->lock);
+        if (storage->write_lock) {
+            _mutex_unlock(storage->write_lock);
+        }
         return ESP_FAIL;
     }
-    // STAILQ_REMOVE(&storage->list, item, esp_storage_item_t, next);
+    esp_storage_item_t **link = &storage->bucket[item->hash & (STORAGE_HASH_SIZE - 1)];
+    while (*link != item) {
+        link = &(*link)->hash_next;
+    }
+    *link = item->hash_next;
+    STAILQ_REMOVE(&storage->list, item, esp_storage_item, next);
+    _mutex_unlock(storage->lock);
+    if (storage->write_lock) {
+        _mutex_unlock(storage->write_lock);
+    }
     free(item->key);
+    free(item->pending);
     free(item);
     return ESP_OK;
 }
 
-esp_err_t esp_storage_save(esp_storage_handle_t storage, const char *key)
+// pack and write or snapshot num keys, one commit for all of them
+esp_err_t esp_storage_save_many(esp_storage_handle_t storage, const char **keys, int num)
 {
-    nvs_handle _nvs_handle;
-    esp_err_t err;
+    esp_err_t result = ESP_OK;
+    int written = 0;
 
     if (storage == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
-    esp_storage_item_t *item = esp_storage_get_item_by_key(storage, key);
-
-    if (item == NULL) {
-        return ESP_FAIL;
-    }
-
+    // buffer is shared by every item, keep it until the blob is written, saves may come from several tasks
     _mutex_lock(storage->lock);
-    int write_size = item->pack(item->context, storage->buffer, storage->buffer_size);
-    _mutex_unlock(storage->lock);
-    if (write_size <= 0) {
-        ESP_LOGE(TAG, "Error save configuration");
-        return ESP_FAIL;
+    if (storage->write_behind == false) {
+        result = esp_storage_open(storage);
+        if (result != ESP_OK) {
+            _mutex_unlock(storage->lock);
+            return result;
+        }
     }
-    // Open
-    err = nvs_open(storage->namespace, NVS_READWRITE, &_nvs_handle);
-    if (err != ESP_OK) {
-        return err;
+    for (int i = 0; i < num; i++) {
+        esp_storage_item_t *item = esp_storage_get_item_by_key(storage, keys[i]);
+        if (item == NULL) {
+            result = ESP_FAIL;
+            continue;
+        }
+        int write_size = esp_storage_pack(storage, item);
+        if (write_size == 0) {
+            result = ESP_FAIL;
+            continue;
+        }
+        esp_err_t err;
+        if (storage->write_behind) {
+            err = esp_storage_snapshot(storage, item, write_size);
+        } else {
+            err = robot_hal_kv_set(storage->kv, item->key, storage->buffer, write_size);
+        }
+        if (err != ESP_OK) {
+            result = err;
+            continue;
+        }
+        written++;
     }
-
-    err = nvs_set_blob(_nvs_handle, item->key, storage->buffer, write_size);
-    if (err != ESP_OK) {
-        goto _save_config_failed;
+    if (written > 0 && storage->write_behind == false) {
+        esp_err_t err = robot_hal_kv_commit(storage->kv);
+        if (err != ESP_OK) {
+            result = err;
+        }
     }
-
-    err = nvs_commit(_nvs_handle);
-    if (err != ESP_OK) {
-        goto _save_config_failed;
+    _mutex_unlock(storage->lock);
+    if (written > 0 && storage->write_behind) {
+        xTaskNotifyGive(storage->task);
     }
+    return result;
+}
 
-_save_config_failed:
-    // Close
-    nvs_close(_nvs_handle);
-    return err;
+esp_err_t esp_storage_save(esp_storage_handle_t storage, const char *key)
+{
+    return esp_storage_save_many(storage, &key, 1);
 }
 
-esp_err_t esp_storage_load(esp_storage_handle_t storage, const char* key)
+esp_err_t esp_storage_flush(esp_storage_handle_t storage)
 {
-    nvs_handle _nvs_handle;
-    esp_err_t err;
     if (storage == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
-    esp_storage_item_t *item = esp_storage_get_item_by_key(storage, key);
-    if (item == NULL) {
-        return ESP_FAIL;
+    if (storage->write_behind == false) {
+        return ESP_OK;
     }
+    return esp_storage_write_pending(storage);
+}
 
+// read and unpack one item, must be called with lock
+static esp_err_t esp_storage_load_item(esp_storage_handle_t storage, esp_storage_item_t *item)
+{
     if (item->unpack == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
-
-
-    // Open
-    err = nvs_open(storage->namespace, NVS_READWRITE, &_nvs_handle);
-    if (err != ESP_OK) {
-        return err;
-    }
-
     size_t read_size = storage->buffer_size;
-    _mutex_lock(storage->lock);
-    err = nvs_get_blob(_nvs_handle, item->key, storage->buffer, &read_size);
-    _mutex_unlock(storage->lock);
-    nvs_close(_nvs_handle);
+    esp_err_t err = robot_hal_kv_get(storage->kv, item->key, storage->buffer, &read_size);
     if (err != ESP_OK || read_size == 0) {
         return err;
     }
+    return item->unpack(item->context, storage->buffer, read_size);
+}
 
-    err = item->unpack(item->context, storage->buffer, read_size);
-
-    if (err != ESP_OK) {
-        return err;
+esp_err_t esp_storage_load(esp_storage_handle_t storage, const char* key)
+{
+    esp_err_t err;
+    if (storage == NULL) {
+        return ESP_ERR_INVALID_STATE;
     }
-    // Close
+    _mutex_lock(storage->lock);
+    esp_storage_item_t *item = esp_storage_get_item_by_key(storage, key);
+    if (item == NULL) {
+        _mutex_unlock(storage->lock);
+        return ESP_FAIL;
+    }
+    err = esp_storage_open(storage);
+    if (err == ESP_OK) {
+        err = esp_storage_load_item(storage, item);
+    }
+    _mutex_unlock(storage->lock);
+    return err;
+}
 
-    return ESP_OK;
+esp_err_t esp_storage_load_all(esp_storage_handle_t storage)
+{
+    esp_err_t result;
+    esp_storage_item_t *item;
+    if (storage == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(storage->lock);
+    result = esp_storage_open(storage);
+    if (result == ESP_OK) {
+        STAILQ_FOREACH(item, &storage->list, next) {
+            esp_err_t err = esp_storage_load_item(storage, item);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "load %s: %d", item->key, err);
+                result = err;
+            }
+        }
+    }
+    _mutex_unlock(storage->lock);
+    return result;
 }
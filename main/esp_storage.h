@@ -9,6 +9,7 @@
 #define _ESP_STORAGE_H_
 
 #include "esp_err.h"
+#include <stdbool.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -31,18 +32,45 @@ typedef esp_err_t (*storage_unpack_func)(void *context, char *buffer, int loaded
  */
 typedef int (*storage_pack_func)(void *context, char *buffer, int max_buffer_size);
 
+/**
+ * Called by the write behind task once a snapshot of the item is committed (ESP_OK) or failed to be written,
+ * a failed snapshot stays pending until the next save or flush
+ */
+typedef void (*storage_written_func)(void *context, esp_err_t err);
+
 typedef struct {
     const char* namespace;
     int         buffer_size;
+    bool        write_behind;       // save only snapshots the item, a low priority task writes it later
+    int         task_priority;      // write behind task
+    int         task_core;
+    int         coalesce_ms;        // saves of a key within this time after the first one are written once
 } esp_storage_config_t;
 
 esp_storage_handle_t esp_storage_init(esp_storage_config_t *config);
 esp_err_t esp_storage_add(esp_storage_handle_t storage, const char *key, storage_unpack_func unpack, storage_pack_func pack, void *context);
 esp_err_t esp_storage_remove(esp_storage_handle_t storage, const char *key);
+esp_err_t esp_storage_set_written(esp_storage_handle_t storage, const char *key, storage_written_func written);
 esp_err_t esp_storage_load(esp_storage_handle_t storage, const char* key);
 esp_err_t esp_storage_save(esp_storage_handle_t storage, const char* key);
+
+/**
+ * Save num keys with one nvs commit, in write behind mode they are snapshot together.
+ * Every key is tried, the last error is returned
+ */
+esp_err_t esp_storage_save_many(esp_storage_handle_t storage, const char **keys, int num);
+
+/**
+ * Load every added item, the last error is returned, items that load fine are unpacked anyway
+ */
+esp_err_t esp_storage_load_all(esp_storage_handle_t storage);
 esp_err_t esp_storage_destroy(esp_storage_handle_t storage);
 
+/**
+ * Write every snapshot still pending in write behind mode from the caller, for shutdown
+ */
+esp_err_t esp_storage_flush(esp_storage_handle_t storage);
+
 
 #ifdef __cplusplus
 }
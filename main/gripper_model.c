@@ -0,0 +1,374 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "robot_config.h"
+#include "robot_hal.h"
+#include "dlog.h"
+#include "gripper_model.h"
+
+static const char *TAG = "GRIPPER_MODEL";
+
+#define GRIPPER_MODEL_MAGIC (0x47524950)     // "GRIP"
+#define GRIPPER_MODEL_VERSION (1)
+#define GRIPPER_MODEL_MIN_DUTY ROBOT_PULSE_MIN_US
+#define GRIPPER_MODEL_MAX_DUTY ROBOT_PULSE_MAX_US
+#define DEFAULT_GRIPPER_MODEL_LUT_SIZE (64)
+#define GRIPPER_MODEL_WIDTH_EPS (1e-4)     // cm
+
+/************************************* CRIPPER WIDE WITH PULSE *********************************************
+ * PULSE (us)    1900    1800    1700    1600    1500    1400    1300    1200    1100
+ *------------------------------------------------------------------------------------
+ * WIDE  (cm)    0.97    1.41    2.40    3.65    4.39    5.00    5.43    5.84    5.96
+ *------------------------------------------------------------------------------------
+ * ADD-LENG(cm)  5.84    5.76    5.54    5.19    4.80    4.38    3.87    3.35    3.01
+ */
+#define GRIPPER_MODEL_FACTORY_DUTY_MIN (1100)     // duty span of factory_point below
+#define GRIPPER_MODEL_FACTORY_DUTY_MAX (1900)
+#if GRIPPER_MODEL_FACTORY_DUTY_MIN < GRIPPER_MODEL_MIN_DUTY || GRIPPER_MODEL_FACTORY_DUTY_MAX > GRIPPER_MODEL_MAX_DUTY
+#error "factory gripper table is outside ROBOT_PULSE_MIN_US / ROBOT_PULSE_MAX_US"
+#endif
+static const gripper_model_point_t factory_point[] = {
+    {0.97, 1900, 5.84}, {1.41, 1800, 5.76}, {2.40, 1700, 5.54}, {3.65, 1600, 5.19}, {4.39, 1500, 4.80},
+    {5.00, 1400, 4.38}, {5.43, 1300, 3.87}, {5.84, 1200, 3.35}, {5.96, 1100, 3.01},
+};
+
+// linear piece of one uniform width cell, value = base + slope * (width - cell start)
+typedef struct {
+    double duty;
+    double duty_slope;
+    double len;
+    double len_slope;
+} gripper_model_cell_t;
+
+// flash record, only calibration points are stored, the lookup table is rebuilt on load
+typedef struct {
+    uint32_t                magic;
+    uint16_t                version;
+    uint16_t                point_num;
+    gripper_model_point_t   point[GRIPPER_MODEL_POINT_MAX];
+} gripper_model_record_t;
+
+struct gripper_model_t {
+    esp_storage_handle_t    storage;
+    char*                   key;
+    int                     lut_size;
+    double                  width_min;
+    double                  width_max;
+    double                  step;
+    double                  inv_step;
+    gripper_model_cell_t*   lut;
+    int                     point_num;
+    gripper_model_point_t   point[GRIPPER_MODEL_POINT_MAX];
+    int                     stage_num;
+    gripper_model_point_t   stage[GRIPPER_MODEL_POINT_MAX];
+    robot_hal_lock_t        lock;
+};
+
+#define _mutex_lock(x)       robot_hal_lock(x)
+#define _mutex_unlock(x)     robot_hal_unlock(x)
+#define _mutex_create()      robot_hal_lock_create()
+#define _mutex_destroy(x)    robot_hal_lock_destroy(x)
+
+static esp_err_t gripper_model_validate(const gripper_model_point_t *point, int num)
+{
+    if (num < GRIPPER_MODEL_POINT_MIN || num > GRIPPER_MODEL_POINT_MAX) {
+        ESP_LOGE(TAG, "point num %d out of range [%d:%d]", num, GRIPPER_MODEL_POINT_MIN, GRIPPER_MODEL_POINT_MAX);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    double duty_dir = point[1].duty - point[0].duty;
+    double len_dir = point[num - 1].len - point[0].len;
+    for (int i = 0; i < num; i++) {
+        if (point[i].duty < GRIPPER_MODEL_MIN_DUTY || point[i].duty > GRIPPER_MODEL_MAX_DUTY || point[i].len < 0) {
+            ESP_LOGE(TAG, "point %d duty: %.0f, len: %.2f is not available", i, point[i].duty, point[i].len);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (i == 0) {
+            continue;
+        }
+        if (point[i].width <= point[i - 1].width) {
+            ESP_LOGE(TAG, "width must increase, point %d: %.2f <= %.2f", i, point[i].width, point[i - 1].width);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if ((point[i].duty - point[i - 1].duty) * duty_dir <= 0 || (point[i].len - point[i - 1].len) * len_dir < 0) {
+            ESP_LOGE(TAG, "duty and len must be monotone, point %d", i);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+// calibration points outside the width limits are refused, the factory table is the only exception
+static esp_err_t gripper_model_validate_limit(const gripper_model_point_t *point, int num)
+{
+    for (int i = 0; i < num; i++) {
+        if (point[i].width < GRIPPER_MODEL_WIDTH_LIMIT_MIN || point[i].width > GRIPPER_MODEL_WIDTH_LIMIT_MAX) {
+            ESP_LOGE(TAG, "point %d width: %.2f out of limit [%.2f:%.2f]", i, point[i].width,
+                     GRIPPER_MODEL_WIDTH_LIMIT_MIN, GRIPPER_MODEL_WIDTH_LIMIT_MAX);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+// monotone cubic hermite tangents (fritsch-carlson), m has num values
+static void gripper_model_tangent(const double *x, const double *y, double *m, int num)
+{
+    double delta[GRIPPER_MODEL_POINT_MAX];
+    for (int i = 0; i < num - 1; i++) {
+        delta[i] = (y[i + 1] - y[i]) / (x[i + 1] - x[i]);
+    }
+    m[0] = delta[0];
+    m[num - 1] = delta[num - 2];
+    for (int i = 1; i < num - 1; i++) {
+        if (delta[i - 1] * delta[i] <= 0) {
+            m[i] = 0;
+            continue;
+        }
+        double h0 = x[i] - x[i - 1], h1 = x[i + 1] - x[i];
+        double w0 = 2 * h1 + h0, w1 = h1 + 2 * h0;
+        m[i] = (w0 + w1) / (w0 / delta[i - 1] + w1 / delta[i]);
+    }
+}
+
+static double gripper_model_hermite(const double *x, const double *y, const double *m, int num, double xv)
+{
+    int i = 0;
+    while (i < num - 2 && xv > x[i + 1]) {
+        i++;
+    }
+    double h = x[i + 1] - x[i];
+    double t = (xv - x[i]) / h;
+    double t2 = t * t, t3 = t2 * t;
+    return (2 * t3 - 3 * t2 + 1) * y[i] + (t3 - 2 * t2 + t) * h * m[i] + (-2 * t3 + 3 * t2) * y[i + 1] +
+           (t3 - t2) * h * m[i + 1];
+}
+
+// resample the spline on a uniform width grid so that lookup is one multiply and one index
+static void gripper_model_build(gripper_model_handle_t model, const gripper_model_point_t *point, int num)
+{
+    double x[GRIPPER_MODEL_POINT_MAX], duty[GRIPPER_MODEL_POINT_MAX], len[GRIPPER_MODEL_POINT_MAX];
+    double duty_m[GRIPPER_MODEL_POINT_MAX], len_m[GRIPPER_MODEL_POINT_MAX];
+    for (int i = 0; i < num; i++) {
+        x[i] = point[i].width;
+        duty[i] = point[i].duty;
+        len[i] = point[i].len;
+    }
+    gripper_model_tangent(x, duty, duty_m, num);
+    gripper_model_tangent(x, len, len_m, num);
+
+    model->width_min = x[0];
+    model->width_max = x[num - 1];
+    model->step = (model->width_max - model->width_min) / model->lut_size;
+    model->inv_step = 1.0 / model->step;
+    double duty_prev = duty[0], len_prev = len[0];
+    for (int k = 0; k < model->lut_size; k++) {
+        double w = k + 1 == model->lut_size ? model->width_max : model->width_min + (k + 1) * model->step;
+        double duty_next = gripper_model_hermite(x, duty, duty_m, num, w);
+        double len_next = gripper_model_hermite(x, len, len_m, num, w);
+        model->lut[k].duty = duty_prev;
+        model->lut[k].duty_slope = (duty_next - duty_prev) * model->inv_step;
+        model->lut[k].len = len_prev;
+        model->lut[k].len_slope = (len_next - len_prev) * model->inv_step;
+        duty_prev = duty_next;
+        len_prev = len_next;
+    }
+    memcpy(model->point, point, num * sizeof(gripper_model_point_t));
+    model->point_num = num;
+    ESP_LOGI(TAG, "model built: %d points, width [%.2lf:%.2lf]", num, model->width_min, model->width_max);
+}
+
+static int gripper_model_pack(void *context, char *buffer, int max_buffer_size)
+{
+    gripper_model_handle_t model = (gripper_model_handle_t)context;
+    if (max_buffer_size < sizeof(gripper_model_record_t)) {
+        ESP_LOGE(TAG, "buffer %d < %d", max_buffer_size, (int)sizeof(gripper_model_record_t));
+        return 0;
+    }
+    gripper_model_record_t *record = (gripper_model_record_t *)buffer;
+    memset(record, 0, sizeof(gripper_model_record_t));
+    record->magic = GRIPPER_MODEL_MAGIC;
+    record->version = GRIPPER_MODEL_VERSION;
+    record->point_num = model->point_num;
+    memcpy(record->point, model->point, model->point_num * sizeof(gripper_model_point_t));
+    return sizeof(gripper_model_record_t);
+}
+
+static esp_err_t gripper_model_unpack(void *context, char *buffer, int loaded_len)
+{
+    gripper_model_handle_t model = (gripper_model_handle_t)context;
+    gripper_model_record_t record;
+    if (loaded_len != sizeof(gripper_model_record_t)) {
+        ESP_LOGW(TAG, "record len %d != %d", loaded_len, (int)sizeof(gripper_model_record_t));
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&record, buffer, sizeof(gripper_model_record_t));
+    if (record.magic != GRIPPER_MODEL_MAGIC || record.version != GRIPPER_MODEL_VERSION) {
+        ESP_LOGW(TAG, "magic: %x, version: %d", record.magic, record.version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    esp_err_t err = gripper_model_validate(record.point, record.point_num);
+    if (err == ESP_OK) {
+        err = gripper_model_validate_limit(record.point, record.point_num);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    gripper_model_build(model, record.point, record.point_num);
+    return ESP_OK;
+}
+
+gripper_model_handle_t gripper_model_init(gripper_model_config_t *config)
+{
+    gripper_model_handle_t model = calloc(1, sizeof(struct gripper_model_t));
+    if (model == NULL) {
+        ESP_LOGE(TAG, "Error calloc memory");
+        return NULL;
+    }
+    model->lut_size = config->lut_size > 0 ? config->lut_size : DEFAULT_GRIPPER_MODEL_LUT_SIZE;
+    model->lut = calloc(model->lut_size, sizeof(gripper_model_cell_t));
+    if (model->lut == NULL) {
+        ESP_LOGE(TAG, "Error calloc lut");
+        goto _model_init_failed;
+    }
+    model->lock = _mutex_create();
+    if (model->lock == NULL) {
+        ESP_LOGE(TAG, "Error create lock");
+        goto _model_init_failed;
+    }
+    int factory_num = sizeof(factory_point) / sizeof(factory_point[0]);
+    gripper_model_build(model, factory_point, factory_num);
+
+    if (config->storage && config->key) {
+        model->key = strdup(config->key);
+        if (model->key == NULL) {
+            ESP_LOGE(TAG, "Error calloc key");
+            goto _model_init_failed;
+        }
+        model->storage = config->storage;
+        esp_storage_add(model->storage, model->key, gripper_model_unpack, gripper_model_pack, model);
+        if (esp_storage_load(model->storage, model->key) != ESP_OK) {
+            ESP_LOGW(TAG, "load calibration fail, use factory table");
+            gripper_model_build(model, factory_point, factory_num);
+        }
+    }
+    memcpy(model->stage, model->point, sizeof(model->point));
+    model->stage_num = model->point_num;
+    return model;
+_model_init_failed:
+    free(model->lut);
+    if (model->lock) {
+        _mutex_destroy(model->lock);
+    }
+    free(model);
+    return NULL;
+}
+
+esp_err_t gripper_model_destroy(gripper_model_handle_t model)
+{
+    if (model == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (model->storage) {
+        esp_storage_remove(model->storage, model->key);
+    }
+    free(model->key);
+    free(model->lut);
+    if (model->lock) {
+        _mutex_destroy(model->lock);
+    }
+    free(model);
+    return ESP_OK;
+}
+
+esp_err_t gripper_model_lookup(gripper_model_handle_t model, double width, int *duty, double *len)
+{
+    if (model == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(model->lock);
+    // the factory table reaches below the width limit, the tighter of both bounds applies
+    double width_min = fmax(model->width_min, GRIPPER_MODEL_WIDTH_LIMIT_MIN);
+    double width_max = fmin(model->width_max, GRIPPER_MODEL_WIDTH_LIMIT_MAX);
+    // calibration widths are float, so table edges are matched with a tolerance
+    if (!(width >= width_min - GRIPPER_MODEL_WIDTH_EPS && width <= width_max + GRIPPER_MODEL_WIDTH_EPS)) {
+        DLOG_F32(DLOG_GRIPPER_WIDTH_RANGE, width, width_min, width_max);
+        _mutex_unlock(model->lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    double offset = width - model->width_min;
+    if (offset < 0) {
+        offset = 0;
+    }
+    int k = (int)(offset * model->inv_step);
+    if (k >= model->lut_size) {
+        k = model->lut_size - 1;     // width == width_max
+    }
+    const gripper_model_cell_t *cell = &model->lut[k];
+    offset -= k * model->step;
+    *duty = (int)(cell->duty + cell->duty_slope * offset);
+    *len = cell->len + cell->len_slope * offset;
+    _mutex_unlock(model->lock);
+    return ESP_OK;
+}
+
+esp_err_t gripper_model_set_point(gripper_model_handle_t model, int idx, const gripper_model_point_t *point)
+{
+    if (model == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(model->lock);
+    if (idx < 0 || idx > model->stage_num || idx >= GRIPPER_MODEL_POINT_MAX) {
+        ESP_LOGE(TAG, "point idx %d out of range [0:%d]", idx, model->stage_num);
+        _mutex_unlock(model->lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    model->stage[idx] = *point;
+    if (idx == model->stage_num) {
+        model->stage_num++;
+    }
+    _mutex_unlock(model->lock);
+    return ESP_OK;
+}
+
+esp_err_t gripper_model_commit(gripper_model_handle_t model, int num)
+{
+    if (model == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(model->lock);
+    bool factory = num == 0;
+    if (factory) {
+        num = sizeof(factory_point) / sizeof(factory_point[0]);
+        memcpy(model->stage, factory_point, sizeof(factory_point));
+    } else if (num > model->stage_num) {
+        ESP_LOGE(TAG, "only %d points staged", model->stage_num);
+        _mutex_unlock(model->lock);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = gripper_model_validate(model->stage, num);
+    if (err == ESP_OK && factory == false) {
+        err = gripper_model_validate_limit(model->stage, num);
+    }
+    if (err != ESP_OK) {
+        _mutex_unlock(model->lock);
+        return err;
+    }
+    gripper_model_build(model, model->stage, num);
+    model->stage_num = num;
+    _mutex_unlock(model->lock);
+
+    if (model->storage) {
+        return esp_storage_save(model->storage, model->key);
+    }
+    return ESP_OK;
+}
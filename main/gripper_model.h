@@ -0,0 +1,69 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _GRIPPER_MODEL_H_
+#define _GRIPPER_MODEL_H_
+
+#include "esp_err.h"
+#include "esp_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GRIPPER_MODEL_POINT_MAX (16)
+#define GRIPPER_MODEL_POINT_MIN (2)
+
+// cm, widths the gripper may be driven to whatever the calibration covers, ROBOT_CRIPPER_MIN / MAX_WIDTH before
+#define GRIPPER_MODEL_WIDTH_LIMIT_MIN (2.0)
+#define GRIPPER_MODEL_WIDTH_LIMIT_MAX (6.0)
+
+typedef struct gripper_model_t* gripper_model_handle_t;
+
+/**
+ * One measured calibration point, widths must be strictly increasing and
+ * duty / length must be monotone over the table
+ */
+typedef struct {
+    float width;     // cm
+    float duty;      // us
+    float len;       // cm, length added to the last link
+} gripper_model_point_t;
+
+typedef struct {
+    esp_storage_handle_t    storage;        // NULL => model is not persisted
+    const char*             key;
+    int                     lut_size;       // number of uniform width cells
+} gripper_model_config_t;
+
+/**
+ * Create the model with the factory table, then load the calibration from storage if any
+ */
+gripper_model_handle_t gripper_model_init(gripper_model_config_t *config);
+esp_err_t gripper_model_destroy(gripper_model_handle_t model);
+
+/**
+ * Constant time lookup of width -> duty and width -> length, no side effect.
+ * Return ESP_ERR_INVALID_ARG if width is out of the calibrated range or of the width limits
+ */
+esp_err_t gripper_model_lookup(gripper_model_handle_t model, double width, int *duty, double *len);
+
+/**
+ * Stage calibration point idx, idx equal to the staged count appends a point
+ */
+esp_err_t gripper_model_set_point(gripper_model_handle_t model, int idx, const gripper_model_point_t *point);
+
+/**
+ * Validate the first num staged points, rebuild the lookup table and persist it.
+ * Every staged width must be inside the width limits. num = 0 restores the factory table
+ */
+esp_err_t gripper_model_commit(gripper_model_handle_t model, int num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
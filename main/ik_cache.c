@@ -0,0 +1,179 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "robot_hal.h"
+#include "ik_cache.h"
+
+static const char *TAG = "IK_CACHE";
+
+typedef struct {
+    ik_cache_key_t  key;
+    int             duty[IK_CACHE_DUTY_NUM];
+    uint32_t        last_use;       // 0 => entry is empty
+} ik_cache_entry_t;
+
+struct ik_cache_t {
+    int                 size;
+    double              resolution;
+    uint32_t            use_count;
+    ik_cache_stats_t    stats;
+    ik_cache_entry_t*   entry;
+    robot_hal_lock_t    lock;
+};
+
+#define DEFAULT_IK_CACHE_SIZE (32)
+#define DEFAULT_IK_CACHE_RESOLUTION (0.01)
+
+#define _mutex_lock(x)       robot_hal_lock(x)
+#define _mutex_unlock(x)     robot_hal_unlock(x)
+#define _mutex_create()      robot_hal_lock_create()
+#define _mutex_destroy(x)    robot_hal_lock_destroy(x)
+
+ik_cache_handle_t ik_cache_init(ik_cache_config_t *config)
+{
+    ik_cache_handle_t cache = calloc(1, sizeof(struct ik_cache_t));
+    if (cache == NULL) {
+        ESP_LOGE(TAG, "Error calloc memory");
+        return NULL;
+    }
+    cache->size = config->size > 0 ? config->size : DEFAULT_IK_CACHE_SIZE;
+    cache->resolution = config->resolution > 0 ? config->resolution : DEFAULT_IK_CACHE_RESOLUTION;
+    cache->entry = calloc(cache->size, sizeof(ik_cache_entry_t));
+    if (cache->entry == NULL) {
+        ESP_LOGE(TAG, "Error calloc entry");
+        goto _cache_init_failed;
+    }
+    cache->lock = _mutex_create();
+    if (cache->lock == NULL) {
+        ESP_LOGE(TAG, "Error create lock");
+        goto _cache_init_failed;
+    }
+    return cache;
+_cache_init_failed:
+    free(cache->entry);
+    free(cache);
+    return NULL;
+}
+
+esp_err_t ik_cache_destroy(ik_cache_handle_t cache)
+{
+    if (cache == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    free(cache->entry);
+    if (cache->lock) {
+        _mutex_destroy(cache->lock);
+    }
+    free(cache);
+    return ESP_OK;
+}
+
+static int32_t ik_cache_quantize(ik_cache_handle_t cache, double value)
+{
+    return (int32_t)lround(value / cache->resolution);
+}
+
+esp_err_t ik_cache_make_key(ik_cache_handle_t cache, ik_cache_key_t *key, int kind, double x, double y, double z,
+                            double angle, double width, double cripper_len, int32_t from)
+{
+    if (cache == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(key, 0, sizeof(ik_cache_key_t));
+    key->kind = kind;
+    key->x = ik_cache_quantize(cache, x);
+    key->y = ik_cache_quantize(cache, y);
+    key->z = ik_cache_quantize(cache, z);
+    key->angle = ik_cache_quantize(cache, angle);
+    key->width = ik_cache_quantize(cache, width);
+    key->cripper_len = ik_cache_quantize(cache, cripper_len);
+    key->from = from;
+    return ESP_OK;
+}
+
+static ik_cache_entry_t* ik_cache_find(ik_cache_handle_t cache, const ik_cache_key_t *key)
+{
+    for (int i = 0; i < cache->size; i++) {
+        if (cache->entry[i].last_use != 0 && memcmp(&cache->entry[i].key, key, sizeof(ik_cache_key_t)) == 0) {
+            return &cache->entry[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t ik_cache_lookup(ik_cache_handle_t cache, const ik_cache_key_t *key, int *duty)
+{
+    if (cache == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(cache->lock);
+    ik_cache_entry_t *entry = ik_cache_find(cache, key);
+    if (entry == NULL) {
+        cache->stats.miss++;
+        _mutex_unlock(cache->lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    entry->last_use = ++cache->use_count;
+    memcpy(duty, entry->duty, sizeof(entry->duty));
+    cache->stats.hit++;
+    _mutex_unlock(cache->lock);
+    return ESP_OK;
+}
+
+esp_err_t ik_cache_insert(ik_cache_handle_t cache, const ik_cache_key_t *key, const int *duty)
+{
+    if (cache == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(cache->lock);
+    ik_cache_entry_t *entry = ik_cache_find(cache, key);
+    if (entry == NULL) {
+        // empty entry has last_use = 0, so it is always the first victim
+        entry = &cache->entry[0];
+        for (int i = 1; i < cache->size; i++) {
+            if (cache->entry[i].last_use < entry->last_use) {
+                entry = &cache->entry[i];
+            }
+        }
+        entry->key = *key;
+    }
+    memcpy(entry->duty, duty, sizeof(entry->duty));
+    entry->last_use = ++cache->use_count;
+    _mutex_unlock(cache->lock);
+    return ESP_OK;
+}
+
+esp_err_t ik_cache_invalidate(ik_cache_handle_t cache)
+{
+    if (cache == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(cache->lock);
+    memset(cache->entry, 0, cache->size * sizeof(ik_cache_entry_t));
+    cache->use_count = 0;
+    cache->stats.invalidate++;
+    _mutex_unlock(cache->lock);
+    ESP_LOGD(TAG, "cache invalidated");
+    return ESP_OK;
+}
+
+esp_err_t ik_cache_get_stats(ik_cache_handle_t cache, ik_cache_stats_t *stats)
+{
+    if (cache == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mutex_lock(cache->lock);
+    *stats = cache->stats;
+    _mutex_unlock(cache->lock);
+    return ESP_OK;
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _IK_CACHE_H_
+#define _IK_CACHE_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IK_CACHE_DUTY_NUM (5)     // arm joints the ik solves, the cripper duty is never cached
+
+typedef struct ik_cache_t* ik_cache_handle_t;
+
+/**
+ * Cache key, all values are quantized by the cache resolution so that
+ * requests which only differ by float noise share the same entry
+ */
+typedef struct {
+    int32_t kind;
+    int32_t x;
+    int32_t y;
+    int32_t z;
+    int32_t angle;
+    int32_t width;
+    int32_t cripper_len;
+    int32_t from;           // start pose hash, 0 if solution does not depend on it
+} ik_cache_key_t;
+
+typedef struct {
+    uint32_t hit;
+    uint32_t miss;
+    uint32_t invalidate;
+} ik_cache_stats_t;
+
+typedef struct {
+    int     size;           // number of entries, least recently used one is replaced
+    double  resolution;     // quantization step of the key (cm, degree)
+} ik_cache_config_t;
+
+ik_cache_handle_t ik_cache_init(ik_cache_config_t *config);
+esp_err_t ik_cache_make_key(ik_cache_handle_t cache, ik_cache_key_t *key, int kind, double x, double y, double z,
+                            double angle, double width, double cripper_len, int32_t from);
+
+/**
+ * Return ESP_OK and fill duty (IK_CACHE_DUTY_NUM values) on hit, ESP_ERR_NOT_FOUND on miss
+ */
+esp_err_t ik_cache_lookup(ik_cache_handle_t cache, const ik_cache_key_t *key, int *duty);
+esp_err_t ik_cache_insert(ik_cache_handle_t cache, const ik_cache_key_t *key, const int *duty);
+
+/**
+ * Drop every entry, must be called when calibration used by the IK changes
+ */
+esp_err_t ik_cache_invalidate(ik_cache_handle_t cache);
+esp_err_t ik_cache_get_stats(ik_cache_handle_t cache, ik_cache_stats_t *stats);
+esp_err_t ik_cache_destroy(ik_cache_handle_t cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdio.h>
+
+#include "esp_timer.h"
+
+#include "robot_boot.h"
+
+typedef struct {
+    volatile uint32_t begin;     // us, 0 => not reached
+    volatile uint32_t end;
+} robot_boot_stamp_t;
+
+static const char *robot_boot_name[ROBOT_BOOT_STAGE_MAX] = {
+    "APP_MAIN", "MCPWM", "NVS_INIT", "NVS_ERASE", "STORAGE", "JOURNAL", "TIMER", "UART", "READY", "FIRST_MOVE",
+};
+
+// every stage is stamped by one task only, 32 bit stores need no lock
+static robot_boot_stamp_t boot_stamp[ROBOT_BOOT_STAGE_MAX];
+
+static uint32_t robot_boot_now(void)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    return now ? now : 1;
+}
+
+void robot_boot_begin(robot_boot_stage_t stage)
+{
+    if (stage < ROBOT_BOOT_STAGE_MAX && boot_stamp[stage].begin == 0) {
+        boot_stamp[stage].begin = robot_boot_now();
+    }
+}
+
+void robot_boot_end(robot_boot_stage_t stage)
+{
+    if (stage >= ROBOT_BOOT_STAGE_MAX || boot_stamp[stage].end != 0) {
+        return;
+    }
+    uint32_t now = robot_boot_now();
+    if (boot_stamp[stage].begin == 0) {
+        boot_stamp[stage].begin = now;
+    }
+    boot_stamp[stage].end = now;
+}
+
+int robot_boot_format(int idx, char *buff, int size)
+{
+    // idx counts reached stages only, a skipped NVS_ERASE leaves no line
+    for (int i = 0; i < ROBOT_BOOT_STAGE_MAX; i++) {
+        uint32_t begin = boot_stamp[i].begin;
+        uint32_t end = boot_stamp[i].end;
+        if (begin == 0) {
+            continue;
+        }
+        if (idx-- > 0) {
+            continue;
+        }
+        int len;
+        if (end == 0) {
+            len = snprintf(buff, size, "BOOTINFO %s t=%u us running", robot_boot_name[i], begin);
+        } else {
+            len = snprintf(buff, size, "BOOTINFO %s t=%u dt=%u us", robot_boot_name[i], begin, end - begin);
+        }
+        return len < size ? len : size - 1;
+    }
+    return 0;
+}
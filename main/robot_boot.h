@@ -0,0 +1,54 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_BOOT_H_
+#define _ROBOT_BOOT_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Boot stages, each one runs once and is stamped with esp_timer (us since the timer started,
+ * early in the second stage bootloader). Stages of different tasks may overlap
+ */
+typedef enum {
+    ROBOT_BOOT_APP_MAIN = 0,     // app_main entered, begin is the startup cost
+    ROBOT_BOOT_MCPWM,            // gpio and mcpwm of the six channels
+    ROBOT_BOOT_NVS_INIT,         // nvs_flash_init
+    ROBOT_BOOT_NVS_ERASE,        // only when nvs had no free page and was erased
+    ROBOT_BOOT_STORAGE,          // servo param, gripper model and pose table load
+    ROBOT_BOOT_JOURNAL,          // last pose journal scan
+    ROBOT_BOOT_TIMER,            // motion task started the tick timer
+    ROBOT_BOOT_UART,             // uart driver install, ahead of the storage load on a shared core
+    ROBOT_BOOT_READY,            // end is the READY frame, commands are accepted from here
+    ROBOT_BOOT_FIRST_MOVE,       // frame of the first motion command to its DONE
+    ROBOT_BOOT_STAGE_MAX,
+} robot_boot_stage_t;
+
+/**
+ * Stamp the begin of stage, ignored if it already began
+ */
+void robot_boot_begin(robot_boot_stage_t stage);
+
+/**
+ * Stamp the end of stage, ignored if it already ended. A stage that never began begins now
+ */
+void robot_boot_end(robot_boot_stage_t stage);
+
+/**
+ * Print report line idx (one per stage reached) into buff, return the line length, 0 when idx is past the last line
+ */
+int robot_boot_format(int idx, char *buff, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
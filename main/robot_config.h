@@ -0,0 +1,159 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_CONFIG_H_
+#define _ROBOT_CONFIG_H_
+
+/*
+ * Compile time shape of the firmware, set in menuconfig > Robot Configuration.
+ * The defaults below are used when a value is not in sdkconfig
+ */
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"     // configMAX_PRIORITIES of the default motion task priority
+
+/*
+ * Task layout. The motion tick (timer isr + _SERVO_RUN_TASK + mcpwm out) owns one core at the top
+ * application priority, command parsing, ik, nvs and logging run on the other core.
+ *
+ * Worst case tick latency on the motion core, isr to last mcpwm write:
+ *   isr entry + queue wake                    ~10 us
+ *   trajectory handoff                        never waits, a torn read is retried on the next tick
+ *   tick body, 6 channels lspb + mcpwm        ~60 us
+ *   ipc / esp_timer tasks (priority 24)       preempt the tick, tens of us
+ *   flash write or erase (nvs save)           stalls both cores while cache is off, up to ~40 ms per
+ *                                             sector erase, the only source that can cost a whole tick
+ *
+ * When every channel is idle the tick timer is paused, publishing a trajectory wakes the motion task
+ * which runs the first tick right away and restarts the timer.
+ */
+#ifdef CONFIG_ROBOT_MOTION_TASK_CORE
+#define ROBOT_MOTION_TASK_CORE CONFIG_ROBOT_MOTION_TASK_CORE
+#else
+#define ROBOT_MOTION_TASK_CORE (1)
+#endif
+
+#ifdef CONFIG_ROBOT_MOTION_TASK_PRIORITY
+#define ROBOT_MOTION_TASK_PRIORITY CONFIG_ROBOT_MOTION_TASK_PRIORITY
+#else
+#define ROBOT_MOTION_TASK_PRIORITY (configMAX_PRIORITIES - 2)     // just below ipc tasks
+#endif
+
+#ifdef CONFIG_ROBOT_COMM_TASK_CORE
+#define ROBOT_COMM_TASK_CORE CONFIG_ROBOT_COMM_TASK_CORE
+#else
+#define ROBOT_COMM_TASK_CORE (0)
+#endif
+
+#ifdef CONFIG_ROBOT_COMM_TASK_PRIORITY
+#define ROBOT_COMM_TASK_PRIORITY CONFIG_ROBOT_COMM_TASK_PRIORITY
+#else
+#define ROBOT_COMM_TASK_PRIORITY (6)
+#endif
+
+#if ROBOT_COMM_TASK_PRIORITY >= ROBOT_MOTION_TASK_PRIORITY
+#error "the command task priority must stay below the motion task priority"
+#endif
+
+#if CONFIG_FREERTOS_UNICORE
+#undef ROBOT_MOTION_TASK_CORE
+#undef ROBOT_COMM_TASK_CORE
+#define ROBOT_MOTION_TASK_CORE (0)
+#define ROBOT_COMM_TASK_CORE (0)
+#endif
+
+/*
+ * Motion
+ */
+
+// 5 joints + cripper, the ik writes channel 0..4 and the gripper model channel 5, so it is not a menu option.
+// Being a constant, every per channel loop has a fixed trip count the compiler can unroll
+#define ROBOT_CHANNEL_NUM (6)
+
+#ifdef CONFIG_ROBOT_TICK_MS
+#define ROBOT_TICK_MS CONFIG_ROBOT_TICK_MS
+#else
+#define ROBOT_TICK_MS (20)
+#endif
+
+// a tick processed later than this after its isr counts as late
+#ifdef CONFIG_ROBOT_TICK_LATE_US
+#define ROBOT_TICK_LATE_US CONFIG_ROBOT_TICK_LATE_US
+#else
+#define ROBOT_TICK_LATE_US (2000)
+#endif
+
+#ifdef CONFIG_ROBOT_PULSE_MIN_US
+#define ROBOT_PULSE_MIN_US CONFIG_ROBOT_PULSE_MIN_US
+#else
+#define ROBOT_PULSE_MIN_US (500)
+#endif
+
+#ifdef CONFIG_ROBOT_PULSE_MAX_US
+#define ROBOT_PULSE_MAX_US CONFIG_ROBOT_PULSE_MAX_US
+#else
+#define ROBOT_PULSE_MAX_US (2500)
+#endif
+
+// calibration of a channel reset to default
+#ifdef CONFIG_ROBOT_CALIB_UPPER_US
+#define ROBOT_CALIB_UPPER_US CONFIG_ROBOT_CALIB_UPPER_US
+#else
+#define ROBOT_CALIB_UPPER_US (2000)
+#endif
+
+#ifdef CONFIG_ROBOT_CALIB_UNDER_US
+#define ROBOT_CALIB_UNDER_US CONFIG_ROBOT_CALIB_UNDER_US
+#else
+#define ROBOT_CALIB_UNDER_US (1000)
+#endif
+
+#if ROBOT_CALIB_UNDER_US < ROBOT_PULSE_MIN_US || ROBOT_CALIB_UPPER_US > ROBOT_PULSE_MAX_US
+#error "default calibration is outside ROBOT_PULSE_MIN_US / ROBOT_PULSE_MAX_US"
+#endif
+
+// precision of the lspb math run every tick, the esp32 fpu is single precision only
+#if CONFIG_ROBOT_MATH_FLOAT
+typedef float robot_real_t;
+#else
+typedef double robot_real_t;
+#endif
+
+/*
+ * Queues and buffers
+ */
+
+#ifdef CONFIG_ROBOT_EVENT_QUEUE_DEPTH
+#define ROBOT_EVENT_QUEUE_DEPTH CONFIG_ROBOT_EVENT_QUEUE_DEPTH
+#else
+#define ROBOT_EVENT_QUEUE_DEPTH (20)
+#endif
+
+// frame buffer of the command task, the uart driver rx ring is twice this
+#ifdef CONFIG_ROBOT_UART_BUF_SIZE
+#define ROBOT_UART_BUF_SIZE CONFIG_ROBOT_UART_BUF_SIZE
+#else
+#define ROBOT_UART_BUF_SIZE (2048)
+#endif
+
+/*
+ * Optional subsystems, stats, trace, latency and deferred log are gated in their own headers
+ */
+
+// 0 => no ik cache, every target is solved
+#ifdef CONFIG_ROBOT_IK_CACHE_SIZE
+#define ROBOT_IK_CACHE_SIZE CONFIG_ROBOT_IK_CACHE_SIZE
+#else
+#define ROBOT_IK_CACHE_SIZE (32)
+#endif
+
+#ifdef CONFIG_ROBOT_TRACE_DEPTH
+#define ROBOT_TRACE_DEPTH CONFIG_ROBOT_TRACE_DEPTH
+#else
+#define ROBOT_TRACE_DEPTH (256)     // ticks, 5 s of motion at the default 20 ms tick
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_HAL_H_
+#define _ROBOT_HAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hardware the motion core and the command loop use. robot_hal_esp.c drives mcpwm, timer group 0,
+ * uart 1 and nvs, host/robot_hal_posix.c keeps the same contract on Linux.
+ * Tasks, queues and event groups stay FreeRTOS, on the host a pthread shim provides them.
+ */
+
+#define ROBOT_HAL_PWM_CHANNEL_MAX (6)
+
+/**
+ * Tick callback, runs in interrupt context on target. Return true when it woke a higher priority task
+ */
+typedef bool (*robot_hal_tick_cb_t)(void *arg);
+
+typedef struct robot_hal_kv *robot_hal_kv_t;
+typedef struct robot_hal_lock *robot_hal_lock_t;
+
+/**
+ * Route channel i to gpio pin[i] at 50 Hz, output stays low until the first write
+ */
+esp_err_t robot_hal_pwm_init(const int *pin, int num);
+
+/**
+ * Set the pulse width of channel, us
+ */
+esp_err_t robot_hal_pwm_write(int channel, uint32_t duty_us);
+
+/**
+ * Periodic tick of period_ms calling cb, created paused. The interrupt is bound to the calling core
+ */
+esp_err_t robot_hal_tick_init(uint32_t period_ms, robot_hal_tick_cb_t cb, void *arg);
+
+/**
+ * Restart a full period from now
+ */
+void robot_hal_tick_start(void);
+void robot_hal_tick_pause(void);
+
+/**
+ * The motion task finished the work of one tick. Nothing on target, a host stepper fires the next tick after it
+ */
+void robot_hal_tick_done(void);
+
+/**
+ * Open the command port, received bytes are buffered up to rx_buf_size
+ */
+esp_err_t robot_hal_serial_init(int baud_rate, int rx_buf_size);
+
+/**
+ * Read up to len bytes, wait at most timeout_ms for the first one. Return the count, 0 on timeout
+ */
+int robot_hal_serial_read(uint8_t *buff, int len, uint32_t timeout_ms);
+
+/**
+ * Bytes received and not read yet
+ */
+int robot_hal_serial_available(void);
+int robot_hal_serial_write(const uint8_t *buff, int len);
+
+/**
+ * Mount the key value store, a full or outdated store is erased
+ */
+esp_err_t robot_hal_kv_init(void);
+esp_err_t robot_hal_kv_open(const char *namespace, robot_hal_kv_t *kv);
+void robot_hal_kv_close(robot_hal_kv_t kv);
+
+/**
+ * Read blob key into buff, *len is the buffer size in and the blob size out
+ */
+esp_err_t robot_hal_kv_get(robot_hal_kv_t kv, const char *key, void *buff, size_t *len);
+
+/**
+ * Stage blob key, it is durable after robot_hal_kv_commit
+ */
+esp_err_t robot_hal_kv_set(robot_hal_kv_t kv, const char *key, const void *buff, size_t len);
+esp_err_t robot_hal_kv_commit(robot_hal_kv_t kv);
+
+/**
+ * Mutex between tasks, never from the tick callback
+ */
+robot_hal_lock_t robot_hal_lock_create(void);
+void robot_hal_lock(robot_hal_lock_t lock);
+void robot_hal_unlock(robot_hal_lock_t lock);
+void robot_hal_lock_destroy(robot_hal_lock_t lock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
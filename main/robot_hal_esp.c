@@ -0,0 +1,232 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "driver/mcpwm.h"
+#include "soc/mcpwm_periph.h"
+#include "driver/timer.h"
+#include "driver/uart.h"
+
+#include "robot_hal.h"
+#include "robot_boot.h"
+
+static const char *TAG = "ROBOT_HAL";
+
+#define HAL_TIMER_DIVIDER (80)          // 1 MHz counter
+#define HAL_TIMER_SCALE_MS (1000U)
+
+#define HAL_UART_NUM UART_NUM_1
+#define HAL_UART_TXD_PINNUM (10)     //(1)
+#define HAL_UART_RXD_PINNUM (9)      //(3)
+#define HAL_UART_RTS_PINNUM (5)      // UART_PIN_NO_CHANGE
+#define HAL_UART_CTS_PINNUM (18)     // UART_PIN_NO_CHANGE
+
+typedef struct {
+    mcpwm_unit_t unit;
+    mcpwm_timer_t timer;
+    mcpwm_io_signals_t io_signal;
+    mcpwm_operator_t op;
+} hal_pwm_map_t;
+
+// two channels per mcpwm timer, A and B operator
+static const hal_pwm_map_t hal_pwm_map[ROBOT_HAL_PWM_CHANNEL_MAX] = {
+    {MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM0A, MCPWM_OPR_A},
+    {MCPWM_UNIT_0, MCPWM_TIMER_0, MCPWM0B, MCPWM_OPR_B},
+    {MCPWM_UNIT_0, MCPWM_TIMER_1, MCPWM1A, MCPWM_OPR_A},
+    {MCPWM_UNIT_0, MCPWM_TIMER_1, MCPWM1B, MCPWM_OPR_B},
+    {MCPWM_UNIT_0, MCPWM_TIMER_2, MCPWM2A, MCPWM_OPR_A},
+    {MCPWM_UNIT_0, MCPWM_TIMER_2, MCPWM2B, MCPWM_OPR_B},
+};
+
+static robot_hal_tick_cb_t hal_tick_cb = NULL;
+static void *hal_tick_arg = NULL;
+
+/*
+ * PWM
+ */
+esp_err_t robot_hal_pwm_init(const int *pin, int num)
+{
+    if (num > ROBOT_HAL_PWM_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    mcpwm_config_t pwm_config;
+    pwm_config.frequency = 50;     // frequency = 50Hz, i.e. for every servo
+    // time period should be 20ms
+    pwm_config.cmpr_a = 0;     // duty cycle of PWMxA = 0
+    pwm_config.cmpr_b = 0;     // duty cycle of PWMxb = 0
+    pwm_config.counter_mode = MCPWM_UP_COUNTER;
+    pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
+    for (int i = 0; i < num; i++) {
+        esp_err_t err = mcpwm_gpio_init(hal_pwm_map[i].unit, hal_pwm_map[i].io_signal, pin[i]);
+        if (err == ESP_OK) {
+            err = mcpwm_init(hal_pwm_map[i].unit, hal_pwm_map[i].timer, &pwm_config);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error pwm channel %d: %d", i, err);
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t robot_hal_pwm_write(int channel, uint32_t duty_us)
+{
+    const hal_pwm_map_t *map = &hal_pwm_map[channel];
+    return mcpwm_set_duty_in_us(map->unit, map->timer, map->op, duty_us);
+}
+
+/*
+ * TICK
+ */
+static void IRAM_ATTR hal_timer_group0_isr(void *para)
+{
+    TIMERG0.hw_timer[0].update = 1;
+    TIMERG0.int_clr_timers.t0 = 1;
+    bool woken = hal_tick_cb(hal_tick_arg);
+    TIMERG0.hw_timer[0].config.alarm_en = TIMER_ALARM_EN;
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+esp_err_t robot_hal_tick_init(uint32_t period_ms, robot_hal_tick_cb_t cb, void *arg)
+{
+    /* Select and initialize basic parameters of the timer */
+    timer_config_t config = {
+        .divider = HAL_TIMER_DIVIDER,
+        .counter_dir = TIMER_COUNT_UP,
+        .counter_en = TIMER_PAUSE,
+        .alarm_en = TIMER_ALARM_EN,
+        .intr_type = TIMER_INTR_LEVEL,
+        .auto_reload = true,
+    };
+    hal_tick_cb = cb;
+    hal_tick_arg = arg;
+    esp_err_t err = timer_init(TIMER_GROUP_0, TIMER_0, &config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    /* Timer's counter will initially start from value below.
+       Also, if auto_reload is set, this value will be automatically reload on
+       alarm */
+    timer_set_counter_value(TIMER_GROUP_0, TIMER_0, 0x00000000ULL);
+
+    /* Configure the alarm value and the interrupt on alarm. */
+    timer_set_alarm_value(TIMER_GROUP_0, TIMER_0, (uint64_t)period_ms * HAL_TIMER_SCALE_MS);
+
+    timer_enable_intr(TIMER_GROUP_0, TIMER_0);
+    // isr is allocated on the calling core
+    return timer_isr_register(TIMER_GROUP_0, TIMER_0, hal_timer_group0_isr, (void *)TIMER_0, ESP_INTR_FLAG_IRAM,
+                              NULL);
+}
+
+void robot_hal_tick_start(void)
+{
+    timer_set_counter_value(TIMER_GROUP_0, TIMER_0, 0x00000000ULL);
+    timer_start(TIMER_GROUP_0, TIMER_0);
+}
+
+void robot_hal_tick_pause(void) { timer_pause(TIMER_GROUP_0, TIMER_0); }
+
+void robot_hal_tick_done(void) {}
+
+/*
+ * SERIAL
+ */
+esp_err_t robot_hal_serial_init(int baud_rate, int rx_buf_size)
+{
+    uart_config_t uart_config = {.baud_rate = baud_rate,
+                                 .data_bits = UART_DATA_8_BITS,
+                                 .parity = UART_PARITY_DISABLE,
+                                 .stop_bits = UART_STOP_BITS_1,
+                                 .flow_ctrl = UART_HW_FLOWCTRL_DISABLE};
+    uart_param_config(HAL_UART_NUM, &uart_config);
+    uart_set_pin(HAL_UART_NUM, HAL_UART_TXD_PINNUM, HAL_UART_RXD_PINNUM, HAL_UART_RTS_PINNUM, HAL_UART_CTS_PINNUM);
+    // driver isr follows the calling task to its core
+    return uart_driver_install(HAL_UART_NUM, rx_buf_size, 0, 0, NULL, 0);
+}
+
+int robot_hal_serial_read(uint8_t *buff, int len, uint32_t timeout_ms)
+{
+    int read = uart_read_bytes(HAL_UART_NUM, buff, len, timeout_ms / portTICK_RATE_MS);
+    return read > 0 ? read : 0;
+}
+
+int robot_hal_serial_available(void)
+{
+    size_t pending = 0;
+    uart_get_buffered_data_len(HAL_UART_NUM, &pending);
+    return (int)pending;
+}
+
+int robot_hal_serial_write(const uint8_t *buff, int len)
+{
+    return uart_write_bytes(HAL_UART_NUM, (const char *)buff, len);
+}
+
+/*
+ * KEY VALUE
+ */
+esp_err_t robot_hal_kv_init(void)
+{
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
+        robot_boot_begin(ROBOT_BOOT_NVS_ERASE);
+        err = nvs_flash_erase();
+        robot_boot_end(ROBOT_BOOT_NVS_ERASE);
+        if (err == ESP_OK) {
+            err = nvs_flash_init();
+        }
+    }
+    return err;
+}
+
+// the nvs_handle itself is the kv handle, 0 is never a valid one
+esp_err_t robot_hal_kv_open(const char *namespace, robot_hal_kv_t *kv)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open(namespace, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        *kv = (robot_hal_kv_t)(uintptr_t)handle;
+    }
+    return err;
+}
+
+void robot_hal_kv_close(robot_hal_kv_t kv) { nvs_close((nvs_handle)(uintptr_t)kv); }
+
+esp_err_t robot_hal_kv_get(robot_hal_kv_t kv, const char *key, void *buff, size_t *len)
+{
+    return nvs_get_blob((nvs_handle)(uintptr_t)kv, key, buff, len);
+}
+
+esp_err_t robot_hal_kv_set(robot_hal_kv_t kv, const char *key, const void *buff, size_t len)
+{
+    return nvs_set_blob((nvs_handle)(uintptr_t)kv, key, buff, len);
+}
+
+esp_err_t robot_hal_kv_commit(robot_hal_kv_t kv) { return nvs_commit((nvs_handle)(uintptr_t)kv); }
+
+/*
+ * LOCK
+ */
+robot_hal_lock_t robot_hal_lock_create(void) { return (robot_hal_lock_t)xSemaphoreCreateMutex(); }
+
+void robot_hal_lock(robot_hal_lock_t lock)
+{
+    while (xSemaphoreTake((SemaphoreHandle_t)lock, portMAX_DELAY) != pdPASS) {
+    }
+}
+
+void robot_hal_unlock(robot_hal_lock_t lock) { xSemaphoreGive((SemaphoreHandle_t)lock); }
+
+void robot_hal_lock_destroy(robot_hal_lock_t lock) { vSemaphoreDelete((SemaphoreHandle_t)lock); }
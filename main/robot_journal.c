@@ -0,0 +1,191 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "rom/crc.h"
+
+#include "robot_journal.h"
+
+#if CONFIG_ROBOT_JOURNAL_ENABLE
+
+static const char *TAG = "ROBOT_JOURNAL";
+
+#define JOURNAL_MAGIC (0x504A)     // "JP"
+#define JOURNAL_VERSION (1)
+#define JOURNAL_RECORD_SIZE (sizeof(robot_journal_record_t))
+#define JOURNAL_SECTOR_RECORDS (SPI_FLASH_SEC_SIZE / JOURNAL_RECORD_SIZE)
+
+typedef struct {
+    uint16_t duty[ROBOT_JOURNAL_CHANNEL_NUM];
+    uint16_t cripper_len;
+} journal_pose_t;
+
+static const esp_partition_t *journal_part = NULL;
+static QueueHandle_t journal_queue = NULL;
+static uint32_t journal_slots = 0;
+// writer task only after init
+static uint32_t journal_slot = 0;     // next slot to write
+static uint32_t journal_seq = 0;      // seq of the last valid record, 0 => empty
+static journal_pose_t journal_pose;   // pose of the last valid record
+
+static uint32_t _journal_crc(const robot_journal_record_t *record)
+{
+    return crc32_le(0, (const uint8_t *)record, offsetof(robot_journal_record_t, crc));
+}
+
+static bool _journal_valid(const robot_journal_record_t *record)
+{
+    return record->magic == JOURNAL_MAGIC && record->version == JOURNAL_VERSION && record->crc == _journal_crc(record);
+}
+
+static bool _journal_blank(const robot_journal_record_t *record)
+{
+    const uint8_t *p = (const uint8_t *)record;
+    for (int i = 0; i < JOURNAL_RECORD_SIZE; i++) {
+        if (p[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the valid record with the highest seq is the last pose, torn or stale records are skipped
+static void _journal_scan(void)
+{
+    robot_journal_record_t record;
+    uint32_t last_slot = journal_slots - 1;
+    for (uint32_t slot = 0; slot < journal_slots; slot++) {
+        if (esp_partition_read(journal_part, slot * JOURNAL_RECORD_SIZE, &record, JOURNAL_RECORD_SIZE) != ESP_OK) {
+            continue;
+        }
+        if (_journal_valid(&record) && record.seq > journal_seq) {
+            journal_seq = record.seq;
+            last_slot = slot;
+            memcpy(journal_pose.duty, record.duty, sizeof(journal_pose.duty));
+            journal_pose.cripper_len = record.cripper_len;
+        }
+    }
+    journal_slot = (last_slot + 1) % journal_slots;
+}
+
+static esp_err_t _journal_write(const journal_pose_t *pose)
+{
+    robot_journal_record_t record;
+    // a slot left dirty by a power cut during a write is skipped, a new sector is erased on entry
+    for (uint32_t n = 0; n < journal_slots; n++) {
+        uint32_t offset = journal_slot * JOURNAL_RECORD_SIZE;
+        if (journal_slot % JOURNAL_SECTOR_RECORDS == 0) {
+            esp_err_t err = esp_partition_erase_range(journal_part, offset, SPI_FLASH_SEC_SIZE);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Error erase sector at 0x%x: %d", offset, err);
+                return err;
+            }
+            break;
+        }
+        if (esp_partition_read(journal_part, offset, &record, JOURNAL_RECORD_SIZE) == ESP_OK &&
+            _journal_blank(&record)) {
+            break;
+        }
+        journal_slot = (journal_slot + 1) % journal_slots;
+    }
+    memset(&record, 0, sizeof(record));
+    record.magic = JOURNAL_MAGIC;
+    record.version = JOURNAL_VERSION;
+    record.seq = journal_seq + 1;
+    memcpy(record.duty, pose->duty, sizeof(record.duty));
+    record.cripper_len = pose->cripper_len;
+    record.crc = _journal_crc(&record);
+    esp_err_t err = esp_partition_write(journal_part, journal_slot * JOURNAL_RECORD_SIZE, &record, JOURNAL_RECORD_SIZE);
+    // the slot is used either way, a failed write is skipped by the next scan
+    journal_slot = (journal_slot + 1) % journal_slots;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error write record %u: %d", record.seq, err);
+        return err;
+    }
+    journal_seq = record.seq;
+    journal_pose = *pose;
+    return ESP_OK;
+}
+
+static void journal_task(void *arg)
+{
+    journal_pose_t pose;
+    while (1) {
+        if (xQueueReceive(journal_queue, &pose, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        // the arm rests at the same pose after GOTO to it or a VALIDATE, nothing to wear
+        if (journal_seq != 0 && memcmp(&pose, &journal_pose, sizeof(pose)) == 0) {
+            continue;
+        }
+        _journal_write(&pose);
+    }
+}
+
+esp_err_t robot_journal_init(int core, int priority)
+{
+    if (journal_part != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_partition_t *part =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ROBOT_JOURNAL_SUBTYPE, ROBOT_JOURNAL_LABEL);
+    if (part == NULL || part->size < SPI_FLASH_SEC_SIZE) {
+        ESP_LOGW(TAG, "no %s partition, journal disabled", ROBOT_JOURNAL_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    journal_part = part;
+    journal_slots = (part->size / SPI_FLASH_SEC_SIZE) * JOURNAL_SECTOR_RECORDS;
+    _journal_scan();
+    ESP_LOGI(TAG, "%u slots, last seq %u, next slot %u", journal_slots, journal_seq, journal_slot);
+
+    journal_queue = xQueueCreate(1, sizeof(journal_pose_t));
+    if (journal_queue == NULL) {
+        ESP_LOGE(TAG, "Error create queue");
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(journal_task, "JOURNAL-TASK", 3 * 1024, NULL, priority, NULL, core) != pdPASS) {
+        ESP_LOGE(TAG, "Error create task");
+        vQueueDelete(journal_queue);
+        journal_queue = NULL;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t robot_journal_last(int *duty, double *cripper_len)
+{
+    if (journal_part == NULL || journal_seq == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    for (int i = 0; i < ROBOT_JOURNAL_CHANNEL_NUM; i++) {
+        duty[i] = journal_pose.duty[i];
+    }
+    *cripper_len = journal_pose.cripper_len / 100.0;
+    return ESP_OK;
+}
+
+void robot_journal_append(const int *duty, double cripper_len)
+{
+    if (journal_queue == NULL) {
+        return;
+    }
+    journal_pose_t pose;
+    for (int i = 0; i < ROBOT_JOURNAL_CHANNEL_NUM; i++) {
+        pose.duty[i] = (uint16_t)duty[i];
+    }
+    pose.cripper_len = (uint16_t)lround(cripper_len * 100);
+    xQueueOverwrite(journal_queue, &pose);
+}
+
+#endif
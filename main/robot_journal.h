@@ -0,0 +1,71 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_JOURNAL_H_
+#define _ROBOT_JOURNAL_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Last pose journal. Every rest pose is appended as one record to the pose_log partition,
+ * sectors are used round robin so each one is erased once per lap. Boot reads back the
+ * record with the highest sequence number and starts the pwm there.
+ */
+
+#define ROBOT_JOURNAL_CHANNEL_NUM (6)
+#define ROBOT_JOURNAL_LABEL "pose_log"
+#define ROBOT_JOURNAL_SUBTYPE (0x40)     // custom data subtype, see partitions.csv
+
+/**
+ * One rest pose as it is written to flash, 32 bytes so a record never crosses a sector
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t magic;                                 // 0xFFFF => erased slot
+    uint16_t version;
+    uint32_t seq;                                   // highest valid seq is the last pose
+    uint16_t duty[ROBOT_JOURNAL_CHANNEL_NUM];       // us
+    uint16_t cripper_len;                           // 0.01 cm
+    uint16_t reserved[3];
+    uint32_t crc;                                   // crc32_le of every byte before it
+} robot_journal_record_t;
+
+#if CONFIG_ROBOT_JOURNAL_ENABLE
+
+/**
+ * Find the partition, scan it for the last pose and start the writer task
+ * ESP_ERR_NOT_FOUND when the partition table has no pose_log, the journal is then disabled
+ */
+esp_err_t robot_journal_init(int core, int priority);
+
+/**
+ * Last pose read at init, ESP_ERR_NOT_FOUND on an empty or missing journal
+ */
+esp_err_t robot_journal_last(int *duty, double *cripper_len);
+
+/**
+ * Queue a pose for the writer task, never blocks, a pose not yet written is replaced.
+ * A pose equal to the last record is not written again
+ */
+void robot_journal_append(const int *duty, double cripper_len);
+
+#else
+
+#define robot_journal_init(core, priority) (ESP_ERR_NOT_SUPPORTED)
+#define robot_journal_last(duty, cripper_len) (ESP_ERR_NOT_SUPPORTED)
+#define robot_journal_append(duty, cripper_len) ((void)(duty), (void)(cripper_len))
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
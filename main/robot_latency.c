@@ -0,0 +1,163 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "robot_latency.h"
+
+#if CONFIG_ROBOT_LATENCY_ENABLE
+
+// interval i ends at stage i + 1, the last one is the whole command
+#define ROBOT_LATENCY_INTERVAL_MAX (ROBOT_LATENCY_STAGE_MAX)
+#define ROBOT_LATENCY_TOTAL (ROBOT_LATENCY_INTERVAL_MAX - 1)
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[ROBOT_LATENCY_HIST_NUM];
+} robot_latency_counter_t;
+
+static const char *robot_latency_name[ROBOT_LATENCY_INTERVAL_MAX] = {
+    "PARSE", "IK", "START", "MOTION", "DONE", "TOTAL",
+};
+
+static robot_latency_counter_t counter[ROBOT_LATENCY_INTERVAL_MAX];
+static int current_id = -1;
+static int64_t stamp[ROBOT_LATENCY_STAGE_MAX];     // 0 => stage not reached
+// stamped from both cores, the critical section is a few stores
+static portMUX_TYPE latency_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void robot_latency_begin(int id_command, int64_t frame_us)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&latency_mux);
+    memset(stamp, 0, sizeof(stamp));
+    current_id = id_command;
+    stamp[ROBOT_LATENCY_FRAME] = frame_us;
+    stamp[ROBOT_LATENCY_PARSED] = now;
+    portEXIT_CRITICAL(&latency_mux);
+}
+
+void robot_latency_stamp(int id_command, robot_latency_stage_t stage)
+{
+    if (stage < 0 || stage >= ROBOT_LATENCY_STAGE_MAX) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&latency_mux);
+    // first stamp wins, a replanned channel must not move the start of the motion
+    if (id_command == current_id && stamp[stage] == 0) {
+        stamp[stage] = now;
+    }
+    portEXIT_CRITICAL(&latency_mux);
+}
+
+// interval us between stage - 1 and stage, or frame and stage for the total, -1 when not reached
+static int64_t robot_latency_interval(const int64_t *s, int interval, int64_t now)
+{
+    if (interval == ROBOT_LATENCY_TOTAL) {
+        int64_t end = s[ROBOT_LATENCY_DONE] ? s[ROBOT_LATENCY_DONE] : now;
+        return end - s[ROBOT_LATENCY_FRAME];
+    }
+    if (s[interval] == 0 || s[interval + 1] == 0) {
+        return -1;
+    }
+    return s[interval + 1] - s[interval];
+}
+
+static void robot_latency_counter_add(robot_latency_counter_t *c, uint32_t us)
+{
+    int bucket = 0;
+    while (bucket < ROBOT_LATENCY_HIST_NUM - 1 && (us >> bucket) != 0) {
+        bucket++;
+    }
+    if (c->count == 0 || us < c->min) {
+        c->min = us;
+    }
+    if (us > c->max) {
+        c->max = us;
+    }
+    c->count++;
+    c->sum += us;
+    c->hist[bucket]++;
+}
+
+void robot_latency_done(int id_command)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&latency_mux);
+    if (id_command == current_id) {
+        stamp[ROBOT_LATENCY_DONE] = now;
+        for (int i = 0; i < ROBOT_LATENCY_INTERVAL_MAX; i++) {
+            int64_t us = robot_latency_interval(stamp, i, now);
+            if (us >= 0) {
+                robot_latency_counter_add(&counter[i], (uint32_t)us);
+            }
+        }
+        // a late DONE of the same id is not counted twice
+        current_id = -1;
+    }
+    portEXIT_CRITICAL(&latency_mux);
+}
+
+int robot_latency_format_last(char *buff, int size)
+{
+    int64_t s[ROBOT_LATENCY_STAGE_MAX];
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&latency_mux);
+    memcpy(s, stamp, sizeof(s));
+    portEXIT_CRITICAL(&latency_mux);
+    // appended to the DONE response before it is written, the last interval runs to now
+    if (s[ROBOT_LATENCY_DONE] == 0) {
+        s[ROBOT_LATENCY_DONE] = now;
+    }
+    int len = snprintf(buff, size, "LAT");
+    for (int i = 0; i < ROBOT_LATENCY_INTERVAL_MAX && len < size; i++) {
+        int64_t us = robot_latency_interval(s, i, now);
+        if (us >= 0) {
+            len += snprintf(buff + len, size - len, " %s=%u", robot_latency_name[i], (uint32_t)us);
+        } else {
+            len += snprintf(buff + len, size - len, " %s=-", robot_latency_name[i]);
+        }
+    }
+    return len < size ? len : size - 1;
+}
+
+void robot_latency_reset(void)
+{
+    portENTER_CRITICAL(&latency_mux);
+    memset(counter, 0, sizeof(counter));
+    portEXIT_CRITICAL(&latency_mux);
+}
+
+// one line per interval, same layout as STATS
+int robot_latency_format(int idx, char *buff, int size)
+{
+    if (idx < 0 || idx >= ROBOT_LATENCY_INTERVAL_MAX) {
+        return 0;
+    }
+    robot_latency_counter_t c;
+    portENTER_CRITICAL(&latency_mux);
+    c = counter[idx];
+    portEXIT_CRITICAL(&latency_mux);
+    uint32_t avg = c.count ? (uint32_t)(c.sum / c.count) : 0;
+    int len = snprintf(buff, size, "LATENCY %s n=%u min=%u avg=%u max=%u us h=", robot_latency_name[idx], c.count,
+                       c.min, avg, c.max);
+    // only non empty buckets, "i:n" with bucket i below 2^i us
+    for (int i = 0; i < ROBOT_LATENCY_HIST_NUM && len < size; i++) {
+        if (c.hist[i]) {
+            len += snprintf(buff + len, size - len, "%d:%u,", i, c.hist[i]);
+        }
+    }
+    return len < size ? len : size - 1;
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_LATENCY_H_
+#define _ROBOT_LATENCY_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ROBOT_LATENCY_HIST_NUM (24)     // bucket i counts intervals in [2^(i-1), 2^i) us, last one up to 8 s
+
+/**
+ * Points of the life of one command, stamped with esp_timer
+ */
+typedef enum {
+    ROBOT_LATENCY_FRAME = 0,     // end byte of the frame is in uart_buffer
+    ROBOT_LATENCY_PARSED,        // command and arguments decoded
+    ROBOT_LATENCY_IK,            // ik solved, trajectory published
+    ROBOT_LATENCY_START,         // motion tick adopted the trajectory
+    ROBOT_LATENCY_END,           // motion tick went idle
+    ROBOT_LATENCY_DONE,          // DONE written to the uart
+    ROBOT_LATENCY_STAGE_MAX,
+} robot_latency_stage_t;
+
+#if CONFIG_ROBOT_LATENCY_ENABLE
+
+/**
+ * Start the record of id_command, FRAME is frame_us and PARSED is now. The previous record is dropped
+ * if it never reached DONE
+ */
+void robot_latency_begin(int id_command, int64_t frame_us);
+
+/**
+ * Stamp a stage of the current record, ignored when id_command is not the current command.
+ * Safe from both the command and the motion task
+ */
+void robot_latency_stamp(int id_command, robot_latency_stage_t stage);
+
+/**
+ * Stamp DONE and add the intervals of the current record to the distributions
+ */
+void robot_latency_done(int id_command);
+
+/**
+ * Print the intervals of the current record so far into buff, "-" for a stage not reached
+ */
+int robot_latency_format_last(char *buff, int size);
+
+/**
+ * Print report line idx (one per interval) into buff, return the line length, 0 when idx is past the last line
+ */
+int robot_latency_format(int idx, char *buff, int size);
+void robot_latency_reset(void);
+
+#else
+
+#define robot_latency_begin(id_command, frame_us) ((void)(frame_us))
+#define robot_latency_stamp(id_command, stage)
+#define robot_latency_done(id_command)
+#define robot_latency_format_last(buff, size) (0)
+#define robot_latency_format(idx, buff, size) (0)
+#define robot_latency_reset()
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
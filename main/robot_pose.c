@@ -0,0 +1,137 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "robot_hal.h"
+#include "servo_control.h"
+#include "robot_pose.h"
+
+static const char *TAG = "ROBOT_POSE";
+
+#define ROBOT_POSE_KEY "robot_pose"
+#define ROBOT_POSE_MAGIC (0x504F5345)     // "POSE"
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t record_size;
+    uint16_t record_num;
+    robot_pose_record_t record[ROBOT_POSE_MAX];
+} robot_pose_table_t;
+
+static robot_pose_table_t pose_table;
+static esp_storage_handle_t pose_storage = NULL;
+static robot_hal_lock_t pose_lock = NULL;
+
+#define _mutex_lock(x)       robot_hal_lock(x)
+#define _mutex_unlock(x)     robot_hal_unlock(x)
+#define _mutex_create()      robot_hal_lock_create()
+
+static void robot_pose_set_default(void)
+{
+    memset(&pose_table, 0, sizeof(pose_table));
+    pose_table.magic = ROBOT_POSE_MAGIC;
+    pose_table.record_size = sizeof(robot_pose_record_t);
+    pose_table.record_num = ROBOT_POSE_MAX;
+}
+
+static int robot_pose_pack(void *context, char *buffer, int max_buffer_size)
+{
+    if (max_buffer_size < sizeof(robot_pose_table_t)) {
+        ESP_LOGE(TAG, "buffer %d < %d", max_buffer_size, (int)sizeof(robot_pose_table_t));
+        return 0;
+    }
+    memcpy(buffer, &pose_table, sizeof(robot_pose_table_t));
+    return sizeof(robot_pose_table_t);
+}
+
+static esp_err_t robot_pose_unpack(void *context, char *buffer, int loaded_len)
+{
+    robot_pose_table_t *table = (robot_pose_table_t *)buffer;
+    if (loaded_len != sizeof(robot_pose_table_t) || table->magic != ROBOT_POSE_MAGIC ||
+        table->record_size != sizeof(robot_pose_record_t) || table->record_num != ROBOT_POSE_MAX) {
+        ESP_LOGW(TAG, "pose table format changed, len: %d", loaded_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&pose_table, buffer, sizeof(robot_pose_table_t));
+    return ESP_OK;
+}
+
+esp_err_t robot_pose_init(esp_storage_handle_t storage)
+{
+    if (storage == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pose_lock = _mutex_create();
+    if (pose_lock == NULL) {
+        ESP_LOGE(TAG, "Error create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    pose_storage = storage;
+    robot_pose_set_default();
+    esp_err_t err = esp_storage_add(pose_storage, ROBOT_POSE_KEY, robot_pose_unpack, robot_pose_pack, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (esp_storage_load(pose_storage, ROBOT_POSE_KEY) != ESP_OK) {
+        ESP_LOGW(TAG, "load pose table fail, start empty");
+        robot_pose_set_default();
+    }
+    return ESP_OK;
+}
+
+esp_err_t robot_pose_save(int id)
+{
+    if (pose_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (id < 0 || id >= ROBOT_POSE_MAX) {
+        ESP_LOGE(TAG, "pose id %d out of range [0:%d]", id, ROBOT_POSE_MAX - 1);
+        return ESP_ERR_INVALID_ARG;
+    }
+    int duty[ROBOT_POSE_CHANNEL];
+    double cripper_len;
+    robot_get_pose(duty, &cripper_len);
+
+    _mutex_lock(pose_lock);
+    robot_pose_record_t *record = &pose_table.record[id];
+    for (int i = 0; i < ROBOT_POSE_CHANNEL; i++) {
+        record->duty[i] = (uint16_t)duty[i];
+    }
+    record->cripper_len = (uint16_t)lround(cripper_len * 100);
+    _mutex_unlock(pose_lock);
+
+    ESP_LOGI(TAG, "pose %d saved: %d %d %d %d %d %d", id, duty[0], duty[1], duty[2], duty[3], duty[4], duty[5]);
+    return esp_storage_save(pose_storage, ROBOT_POSE_KEY);
+}
+
+esp_err_t robot_pose_goto(int id)
+{
+    if (pose_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (id < 0 || id >= ROBOT_POSE_MAX) {
+        ESP_LOGE(TAG, "pose id %d out of range [0:%d]", id, ROBOT_POSE_MAX - 1);
+        return ESP_ERR_INVALID_ARG;
+    }
+    int duty[ROBOT_POSE_CHANNEL];
+    _mutex_lock(pose_lock);
+    robot_pose_record_t record = pose_table.record[id];
+    _mutex_unlock(pose_lock);
+    if (record.duty[0] == 0) {
+        ESP_LOGE(TAG, "pose %d is empty", id);
+        return ESP_ERR_NOT_FOUND;
+    }
+    for (int i = 0; i < ROBOT_POSE_CHANNEL; i++) {
+        duty[i] = record.duty[i];
+    }
+    return robot_set_pose(duty, record.cripper_len / 100.0);
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_POSE_H_
+#define _ROBOT_POSE_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ROBOT_POSE_MAX (32)             // pose id is [0:ROBOT_POSE_MAX - 1]
+#define ROBOT_POSE_CHANNEL (6)
+
+/**
+ * One taught pose as it is stored in flash, record index is the pose id.
+ * A record with duty[0] = 0 is empty.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t duty[ROBOT_POSE_CHANNEL];     // us
+    uint16_t cripper_len;                  // 0.01 cm
+} robot_pose_record_t;
+
+/**
+ * Register the pose table under its own key in storage and load it
+ */
+esp_err_t robot_pose_init(esp_storage_handle_t storage);
+
+/**
+ * Capture the current duty_target vector as pose id and persist the table
+ */
+esp_err_t robot_pose_save(int id);
+
+/**
+ * Move to pose id, the stored duty vector is replayed without any IK
+ */
+esp_err_t robot_pose_goto(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
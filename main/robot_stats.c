@@ -0,0 +1,138 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "robot_stats.h"
+
+#if CONFIG_ROBOT_STATS_ENABLE
+
+static const char *TAG = "ROBOT_STATS";
+
+#ifdef CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#define ROBOT_STATS_CPU_MHZ CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#else
+#define ROBOT_STATS_CPU_MHZ (240)
+#endif
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[ROBOT_STATS_HIST_NUM];
+} robot_stats_counter_t;
+
+static const char *robot_stats_name[ROBOT_STATS_MAX] = {
+    "TICK", "SETPOS", "SETPOSNARG", "SETWIDPOS", "SETPOSANGWID", "SETWID", "SETPOSE", "SETHOME", "SETDUTY", "READ",
+};
+static const char *robot_stats_gauge_name[ROBOT_STATS_GAUGE_MAX] = {
+    "EVENTQ",
+};
+
+static robot_stats_counter_t counter[ROBOT_STATS_MAX];
+static uint32_t gauge[ROBOT_STATS_GAUGE_MAX];
+static TaskHandle_t task[ROBOT_STATS_TASK_MAX];
+static int task_num = 0;
+// recorded from both cores, the critical section is a few instructions
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void robot_stats_record(robot_stats_id_t id, uint32_t cycles)
+{
+    if (id < 0 || id >= ROBOT_STATS_MAX) {
+        return;
+    }
+    uint32_t us = cycles / ROBOT_STATS_CPU_MHZ;
+    int bucket = 0;
+    while (bucket < ROBOT_STATS_HIST_NUM - 1 && (us >> bucket) != 0) {
+        bucket++;
+    }
+    robot_stats_counter_t *c = &counter[id];
+    portENTER_CRITICAL(&stats_mux);
+    if (c->count == 0 || cycles < c->min) {
+        c->min = cycles;
+    }
+    if (cycles > c->max) {
+        c->max = cycles;
+    }
+    c->count++;
+    c->sum += cycles;
+    c->hist[bucket]++;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+void robot_stats_gauge(robot_stats_gauge_t id, uint32_t value)
+{
+    if (id < 0 || id >= ROBOT_STATS_GAUGE_MAX) {
+        return;
+    }
+    portENTER_CRITICAL(&stats_mux);
+    if (value > gauge[id]) {
+        gauge[id] = value;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+esp_err_t robot_stats_add_task(TaskHandle_t handle)
+{
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&stats_mux);
+    if (task_num < ROBOT_STATS_TASK_MAX) {
+        task[task_num++] = handle;
+    } else {
+        err = ESP_ERR_NO_MEM;
+    }
+    portEXIT_CRITICAL(&stats_mux);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "task table is full");
+    }
+    return err;
+}
+
+void robot_stats_reset(void)
+{
+    portENTER_CRITICAL(&stats_mux);
+    memset(counter, 0, sizeof(counter));
+    memset(gauge, 0, sizeof(gauge));
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+// one line per counter, then gauges, then task stacks
+int robot_stats_format(int idx, char *buff, int size)
+{
+    if (idx < ROBOT_STATS_MAX) {
+        robot_stats_counter_t c;
+        portENTER_CRITICAL(&stats_mux);
+        c = counter[idx];
+        portEXIT_CRITICAL(&stats_mux);
+        uint32_t avg = c.count ? (uint32_t)(c.sum / c.count) : 0;
+        int len = snprintf(buff, size, "STATS %s n=%u min=%u avg=%u max=%u us h=", robot_stats_name[idx], c.count,
+                           c.min / ROBOT_STATS_CPU_MHZ, avg / ROBOT_STATS_CPU_MHZ, c.max / ROBOT_STATS_CPU_MHZ);
+        // only non empty buckets, "i:n" with bucket i below 2^i us
+        for (int i = 0; i < ROBOT_STATS_HIST_NUM && len < size; i++) {
+            if (c.hist[i]) {
+                len += snprintf(buff + len, size - len, "%d:%u,", i, c.hist[i]);
+            }
+        }
+        return len < size ? len : size - 1;
+    }
+    idx -= ROBOT_STATS_MAX;
+    if (idx < ROBOT_STATS_GAUGE_MAX) {
+        return snprintf(buff, size, "STATS %s hwm=%u", robot_stats_gauge_name[idx], gauge[idx]);
+    }
+    idx -= ROBOT_STATS_GAUGE_MAX;
+    if (idx < task_num) {
+        return snprintf(buff, size, "STATS STACK %s free=%u", pcTaskGetTaskName(task[idx]),
+                        (unsigned)uxTaskGetStackHighWaterMark(task[idx]));
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_STATS_H_
+#define _ROBOT_STATS_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ROBOT_STATS_HIST_NUM (16)     // bucket i counts durations in [2^(i-1), 2^i) us
+#define ROBOT_STATS_TASK_MAX (4)
+
+typedef enum {
+    ROBOT_STATS_TICK = 0,              // _servo_run_task tick body
+    ROBOT_STATS_SET_POS,               // robot_set_position
+    ROBOT_STATS_SET_POSNARG,           // robot_set_position_with_angle
+    ROBOT_STATS_SET_WIDPOS,            // robot_set_width_position
+    ROBOT_STATS_SET_POSANGWID,         // robot_set_position_angle_width
+    ROBOT_STATS_SET_WID,               // robot_set_cripper_width
+    ROBOT_STATS_SET_POSE,              // robot_set_pose
+    ROBOT_STATS_SET_HOME,              // robot_set_home
+    ROBOT_STATS_SET_DUTY,              // servo_duty_set_lspb_calc
+    ROBOT_STATS_READ_COMMAND,          // robot_read_command, frames only
+    ROBOT_STATS_MAX,
+} robot_stats_id_t;
+
+typedef enum {
+    ROBOT_STATS_EVENT_QUEUE = 0,       // servo event queue depth
+    ROBOT_STATS_GAUGE_MAX,
+} robot_stats_gauge_t;
+
+#if CONFIG_ROBOT_STATS_ENABLE
+
+#include "xtensa/hal.h"
+
+// cycle counter of the running core, both stamps must be taken on the same core
+#define ROBOT_STATS_BEGIN(stamp) uint32_t stamp = xthal_get_ccount()
+#define ROBOT_STATS_END(id, stamp) robot_stats_record(id, xthal_get_ccount() - (stamp))
+
+void robot_stats_record(robot_stats_id_t id, uint32_t cycles);
+
+/**
+ * Keep the high water mark of a sampled value
+ */
+void robot_stats_gauge(robot_stats_gauge_t id, uint32_t value);
+
+/**
+ * Task whose stack high water mark is reported, at most ROBOT_STATS_TASK_MAX
+ */
+esp_err_t robot_stats_add_task(TaskHandle_t task);
+void robot_stats_reset(void);
+
+/**
+ * Print report line idx into buff, return the line length, 0 when idx is past the last line
+ */
+int robot_stats_format(int idx, char *buff, int size);
+
+#else
+
+#define ROBOT_STATS_BEGIN(stamp)
+#define ROBOT_STATS_END(id, stamp)
+
+#define robot_stats_record(id, cycles)
+#define robot_stats_gauge(id, value)
+#define robot_stats_add_task(task)
+#define robot_stats_reset()
+#define robot_stats_format(idx, buff, size) (0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
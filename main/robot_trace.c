@@ -0,0 +1,128 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "robot_trace.h"
+
+#if CONFIG_ROBOT_TRACE_ENABLE
+
+static const char *TAG = "ROBOT_TRACE";
+
+static robot_trace_record_t *ring = NULL;
+static int ring_depth = 0;
+static int ring_head = 0;      // next record to write
+static int ring_count = 0;
+static int post_count = 0;
+static volatile robot_trace_state_t state = ROBOT_TRACE_STOPPED;
+// command task controls, motion task records, both only hold it for a few stores
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t robot_trace_init(int depth)
+{
+    if (ring != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ring = calloc(depth, sizeof(robot_trace_record_t));
+    if (ring == NULL) {
+        ESP_LOGE(TAG, "Error calloc %d records", depth);
+        return ESP_ERR_NO_MEM;
+    }
+    ring_depth = depth;
+    return ESP_OK;
+}
+
+static void robot_trace_restart(robot_trace_state_t next, int post)
+{
+    if (ring == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&trace_mux);
+    ring_head = 0;
+    ring_count = 0;
+    post_count = post;
+    state = next;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+void robot_trace_start(void) { robot_trace_restart(ROBOT_TRACE_RUNNING, 0); }
+
+void robot_trace_arm(int post)
+{
+    if (post <= 0 || post > ring_depth) {
+        post = ring_depth / 2;
+    }
+    robot_trace_restart(ROBOT_TRACE_ARMED, post);
+}
+
+void robot_trace_stop(void)
+{
+    portENTER_CRITICAL(&trace_mux);
+    state = ROBOT_TRACE_STOPPED;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+void robot_trace_trigger(void)
+{
+    if (state != ROBOT_TRACE_ARMED) {
+        return;
+    }
+    portENTER_CRITICAL(&trace_mux);
+    if (state == ROBOT_TRACE_ARMED) {
+        state = ROBOT_TRACE_TRIGGERED;
+    }
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+void robot_trace_record(uint32_t time_ms, const int *duty_current, const int *duty_target, const uint8_t *phase)
+{
+    if (state == ROBOT_TRACE_STOPPED) {
+        return;
+    }
+    portENTER_CRITICAL(&trace_mux);
+    if (state != ROBOT_TRACE_STOPPED) {
+        robot_trace_record_t *record = &ring[ring_head];
+        record->time_ms = time_ms;
+        for (int i = 0; i < ROBOT_TRACE_CHANNEL_NUM; i++) {
+            record->duty_current[i] = (uint16_t)duty_current[i];
+            record->duty_target[i] = (uint16_t)duty_target[i];
+            record->phase[i] = phase[i];
+        }
+        ring_head = (ring_head + 1) % ring_depth;
+        if (ring_count < ring_depth) {
+            ring_count++;
+        }
+        if (state == ROBOT_TRACE_TRIGGERED && --post_count <= 0) {
+            state = ROBOT_TRACE_STOPPED;
+        }
+    }
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+robot_trace_state_t robot_trace_get_state(void) { return state; }
+
+int robot_trace_count(void) { return ring_count; }
+
+int robot_trace_read(int idx, robot_trace_record_t *record, int num)
+{
+    if (state != ROBOT_TRACE_STOPPED || idx < 0 || idx >= ring_count) {
+        return 0;
+    }
+    if (num > ring_count - idx) {
+        num = ring_count - idx;
+    }
+    // oldest record sits at head once the ring has wrapped
+    int oldest = ring_count < ring_depth ? 0 : ring_head;
+    for (int i = 0; i < num; i++) {
+        record[i] = ring[(oldest + idx + i) % ring_depth];
+    }
+    return num;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _ROBOT_TRACE_H_
+#define _ROBOT_TRACE_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ROBOT_TRACE_CHANNEL_NUM (6)
+
+typedef enum {
+    ROBOT_TRACE_STOPPED = 0,
+    ROBOT_TRACE_RUNNING,        // ring is overwritten until stopped
+    ROBOT_TRACE_ARMED,          // running, waiting for the next trajectory to be adopted
+    ROBOT_TRACE_TRIGGERED,      // running, stops after the post trigger count
+} robot_trace_state_t;
+
+/**
+ * One motion tick, little endian, this is also the layout of TRACE DUMP
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t time_ms;                                   // esp_timer time of the tick
+    uint16_t duty_current[ROBOT_TRACE_CHANNEL_NUM];     // us
+    uint16_t duty_target[ROBOT_TRACE_CHANNEL_NUM];      // us
+    uint8_t  phase[ROBOT_TRACE_CHANNEL_NUM];            // servo_lspb_phase_t
+} robot_trace_record_t;
+
+#if CONFIG_ROBOT_TRACE_ENABLE
+
+/**
+ * Allocate the ring of depth records, recorder starts stopped
+ */
+esp_err_t robot_trace_init(int depth);
+
+/**
+ * Clear the ring and record every tick until stopped
+ */
+void robot_trace_start(void);
+void robot_trace_stop(void);
+
+/**
+ * Clear the ring and record, when the next trajectory is adopted keep post more ticks then stop
+ */
+void robot_trace_arm(int post);
+
+/**
+ * Motion task only
+ */
+void robot_trace_trigger(void);
+void robot_trace_record(uint32_t time_ms, const int *duty_current, const int *duty_target, const uint8_t *phase);
+
+robot_trace_state_t robot_trace_get_state(void);
+
+/**
+ * Copy up to num records from idx (0 = oldest), return the number copied. The recorder must be stopped
+ */
+int robot_trace_read(int idx, robot_trace_record_t *record, int num);
+int robot_trace_count(void);
+
+#else
+
+#define robot_trace_init(depth)
+#define robot_trace_start()
+#define robot_trace_stop()
+#define robot_trace_arm(post)
+#define robot_trace_trigger()
+#define robot_trace_record(time_ms, duty_current, duty_target, phase)
+#define robot_trace_get_state() (ROBOT_TRACE_STOPPED)
+#define robot_trace_read(idx, record, num) (0)
+#define robot_trace_count() (0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
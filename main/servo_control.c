@@ -1,7 +1,19 @@
-#include "servo_control.h"
+#include <stddef.h>
+
+#include "rom/crc.h"
 
-#define SERVO_MIN_PULSEWIDTH (500)      // Minimum pulse width in us
-#define SERVO_MAX_PULSEWIDTH (2500)     // Maximum pulse width in us
+#include "servo_control.h"
+#include "servo_lspb.h"
+#include "robot_stats.h"
+#include "robot_trace.h"
+#include "dlog.h"
+#include "robot_latency.h"
+#include "robot_journal.h"
+#include "robot_boot.h"
+#include "robot_hal.h"
+
+#define SERVO_MIN_PULSEWIDTH ROBOT_PULSE_MIN_US     // Minimum pulse width in us
+#define SERVO_MAX_PULSEWIDTH ROBOT_PULSE_MAX_US     // Maximum pulse width in us
 #define SERVO_MAX_DEGREE (90)
 
 #define SERVO_PINNUM_0 (15)
@@ -20,28 +32,47 @@
 #define SERVO_CHANNEL_4 (4)
 #define SERVO_CHANNEL_5 (5)
 
-#define SERVO_MAX_CHANNEL (6)
-#define SERVO_TIME_STEP (20)     // 20 ms is timer isr step to caculate
+#define SERVO_MAX_CHANNEL ROBOT_CHANNEL_NUM
+#define SERVO_TIME_STEP ROBOT_TICK_MS     // timer isr step to caculate, ms
 #define SERVO_NVS_MAGIC (0x27069700)
-#define DEFAULT_UPPER_LIMIT (2000)
-#define DEFAULT_UNDER_LIMIT (1000)
-
-#define TIMER_DIVIDER (80)
-#define TIMER_SCALE_SEC (1000000U)
-#define TIMER_SCALE_MS (1000U)
-#define TIMER_SCALE_US (1U)
-#define TIMER_CLEAR (1)
-#define TIMER_AUTO_RELOAD (1)
-
-#define NVS_SAVE_TIME (3000)     //  60 second per save
+#define SERVO_NVS_VERSION (1)
+#define DEFAULT_UPPER_LIMIT ROBOT_CALIB_UPPER_US
+#define DEFAULT_UNDER_LIMIT ROBOT_CALIB_UNDER_US
+
+// boot and SETHOME pose in us, channel 0..4 then the open cripper
+#define SERVO_HOME_DUTY_0 (1500)
+#define SERVO_HOME_DUTY_1 (1050)
+#define SERVO_HOME_DUTY_2 (1980)
+#define SERVO_HOME_DUTY_3 (2100)
+#define SERVO_HOME_DUTY_4 (1500)
+#define SERVO_HOME_DUTY_5 (1900)
+#define SERVO_HOME_DUTY \
+    {SERVO_HOME_DUTY_0, SERVO_HOME_DUTY_1, SERVO_HOME_DUTY_2, SERVO_HOME_DUTY_3, SERVO_HOME_DUTY_4, SERVO_HOME_DUTY_5}
+#define SERVO_IN_PULSE(duty) ((duty) >= SERVO_MIN_PULSEWIDTH && (duty) <= SERVO_MAX_PULSEWIDTH)
+#if !SERVO_IN_PULSE(SERVO_HOME_DUTY_0) || !SERVO_IN_PULSE(SERVO_HOME_DUTY_1) || \
+    !SERVO_IN_PULSE(SERVO_HOME_DUTY_2) || !SERVO_IN_PULSE(SERVO_HOME_DUTY_3) || \
+    !SERVO_IN_PULSE(SERVO_HOME_DUTY_4) || !SERVO_IN_PULSE(SERVO_HOME_DUTY_5)
+#error "home pose is outside ROBOT_PULSE_MIN_US / ROBOT_PULSE_MAX_US, SETHOME would be refused"
+#endif
+
+#define NVS_SAVE_TIME (60000 / SERVO_TIME_STEP)     // ticks, 60 second per save
+
+#define IK_CACHE_SIZE ROBOT_IK_CACHE_SIZE     // pick and place cells reuse a few dozen targets
+#define IK_CACHE_RESOLUTION (0.01)      // cm and degree
+#define IK_CACHE_FROM_STEP (10)         // us, start pose quantization when ik select is travel based
+#define GRIPPER_MODEL_LUT_SIZE (64)     // uniform width cells of the gripper model
 
 #define EVENT_ID_BASE (0x11)
 
+// motion group bits, set by the motion task for the command waiting in robot_wait_done
+#define MOTION_DONE_BIT (BIT0)      // tick suspended, motion_done_seq is the trajectory it ran
+#define MOTION_ERROR_BIT (BIT1)     // a channel reported SERVO_STATUS_ERROR
+
 // semaphore macro
-#define mutex_lock(x) while (xSemaphoreTake(x, portMAX_DELAY) != pdPASS)
-#define mutex_unlock(x) xSemaphoreGive(x)
-#define mutex_create() xSemaphoreCreateMutex()
-#define mutex_destroy(x) vQueueDelete(x)
+#define mutex_lock(x) robot_hal_lock(x)
+#define mutex_unlock(x) robot_hal_unlock(x)
+#define mutex_create() robot_hal_lock_create()
+#define mutex_destroy(x) robot_hal_lock_destroy(x)
 
 // // event bit wait macro
 // #define event_clear(event_handler, bit) xEventGroupClearBits(event_handler, bit)
@@ -57,37 +88,26 @@
 typedef enum {
     EVENT_TIMER_SERVO = EVENT_ID_BASE,
     EVENT_NVS_SAVE,
+    EVENT_SERVO_WAKE,     // new trajectory published, restart the tick if it is suspended
 } event_type_t;
 
+// seq and stamp are only set for EVENT_TIMER_SERVO
+typedef struct {
+    event_type_t type;
+    uint32_t seq;       // isr tick number, a gap means the queue was full
+    int64_t stamp;      // us, esp_timer_get_time in the isr
+} servo_event_t;
+
+typedef enum {
+    ROBOT_IK_POSITION = 0,         // theta[1] searched in workspace
+    ROBOT_IK_POSITION_ANGLE,       // cripper vertical, wrist angle given
+} robot_ik_kind_t;
+
 /*
  *
  ****************STRUCT DECLARE*******************
  *
  */
-typedef struct {
-    double a;
-    double P0;
-    double Pf;
-    int tf;
-    int tb;
-} math_lspb_vector_t;
-
-typedef struct {
-    mcpwm_unit_t unit;
-    mcpwm_timer_t timer;
-    mcpwm_io_signals_t io_signal;
-    mcpwm_operator_t op;
-    uint64_t pinnum;
-} servo_config_t;
-
-typedef struct {
-    int duty_current;     // duty current
-    int duty_target;      // duty target
-    math_lspb_vector_t lspb;
-    servo_status_t status;
-    int time_count;
-} servo_channel_ctrl_t;
-
 typedef struct {
     double scale;
     double bias;
@@ -96,26 +116,92 @@ typedef struct {
 } servo_channel_calib_t;
 
 typedef struct {
-    servo_channel_ctrl_t channel[6];
+    servo_channel_ctrl_t channel[SERVO_MAX_CHANNEL];
     servo_channel_calib_t duty_calib[5];
     uint32_t time_full;     // time_step to caculate
     uint32_t time_balance;
     servo_status_t status;
-    int nvs_magic;
     double cripper_len;
 } servo_handle_t;
 
+// flash record, calibration and timing only, motion state is never stored
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;     // sizeof the record, a layout change without a version bump still fails
+    servo_channel_calib_t duty_calib[SERVO_MAX_CHANNEL - 1];
+    uint32_t time_full;
+    uint32_t time_balance;
+    uint32_t crc;     // crc32_le of every byte before it
+} servo_nvs_record_t;
+
+// move handed from the command task to the motion task, a channel is replanned when its plan_id changes
+typedef struct {
+    int duty_target[SERVO_MAX_CHANNEL];
+    uint32_t plan_id[SERVO_MAX_CHANNEL];
+    uint32_t time_full;
+    uint32_t time_balance;
+    double cripper_len;     // gripper length the duty_target was solved for, journaled with it
+    int cmd_id;             // command that published it, for latency stamps
+} robot_trajectory_t;
+
+// motion task state published every tick for the command side
+typedef struct {
+    int duty_current[SERVO_MAX_CHANNEL];
+    uint32_t adopted_seq;     // trajectory_seq the tick runs
+    servo_status_t status;
+} robot_tick_state_t;
+
+// state the ik starts from, copied under servo_lock so the solve itself runs unlocked
+typedef struct {
+    int duty_current[SERVO_MAX_CHANNEL];
+    int duty_target[SERVO_MAX_CHANNEL];
+    double cripper_len;
+    uint32_t time_full;
+} robot_snapshot_t;
+
 /*
  *
  ******************GLOBAL VARAIABLE DECLARE*******************
  *
  */
 
-static SemaphoreHandle_t servo_lock;
+static robot_hal_lock_t servo_lock;     // command side state, the motion task never takes it
 static servo_handle_t servo_handler;
-static servo_config_t servo_config_pv[6];
+// double buffers with a sequence counter, buffer (seq & 1) is the published one, one writer each
+static robot_trajectory_t trajectory_buf[2];
+static volatile uint32_t trajectory_seq = 0;
+static robot_tick_state_t tick_state_buf[2];
+static volatile uint32_t tick_state_seq = 0;
+static robot_trajectory_t plan;           // command side working copy, guarded by servo_lock
+static robot_trajectory_t trajectory;     // copy the motion task runs
+static volatile int plan_cmd_id = -1;     // set by the command task before a robot_set_*
+static EventGroupHandle_t motion_group;
+static volatile uint32_t motion_done_seq = 0;
+static servo_nvs_record_t servo_nvs_record;     // staged by the command task, written at rest
+static volatile bool servo_nvs_dirty = false;     // staged record not committed to flash yet
+static uint32_t servo_nvs_stage_seq = 0;           // servo_nvs_mux, bumped by every stage
+static uint32_t servo_nvs_packed_seq = 0;          // servo_nvs_mux, stage the last snapshot was taken from
+static portMUX_TYPE servo_nvs_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t tick_adopted_seq = 0;
+static const int servo_pin[SERVO_MAX_CHANNEL] = {SERVO_PINNUM_0, SERVO_PINNUM_1, SERVO_PINNUM_2,
+                                                   SERVO_PINNUM_3, SERVO_PINNUM_4, SERVO_PINNUM_5};
+static int servo_duty_written[SERVO_MAX_CHANNEL] = {0};     // last duty sent to mcpwm, 0 => never written
+static bool tick_suspended = false;         // motion task only
+static uint8_t servo_phase[SERVO_MAX_CHANNEL] = {0};        // servo_lspb_phase_t of the last tick, motion task only
+static volatile uint32_t tick_isr_seq = 0;
+static uint32_t tick_last_seq = 0;          // motion task only
+static robot_tick_stats_t tick_stats;
+static portMUX_TYPE tick_stats_mux = portMUX_INITIALIZER_UNLOCKED;
 static esp_storage_handle_t storage_handle = NULL;
 static int nvs_time_save = 0;
+static ik_cache_handle_t ik_cache_handle = NULL;
+static gripper_model_handle_t gripper_model_handle = NULL;
+static robot_ik_select_t ik_select = {
+    .mode = ROBOT_IK_SELECT_MIN_DISTANCE,
+    .weight = {1.0, 1.0, 1.0, 1.0, 1.0},
+    .speed = {6.0, 6.0, 6.0, 6.0, 6.0},     // ~60 degree per 100 ms, no load
+};
 xQueueHandle event_queue;
 
 /*
@@ -128,12 +214,13 @@ servo_status_t _servo_channel_check_status(servo_channel_ctrl_t *servo_channel);
 void _servo_channel_check_duty_error(servo_channel_ctrl_t *servo_channel);
 
 static void _servo_run_task(void *arg);
-static void _timer_init(bool auto_reload, double timer_interval, const int TIMER_SCALE);
-void IRAM_ATTR _timer_group0_isr(void *para);
+static void _timer_init(uint32_t period_ms);
+static bool IRAM_ATTR _servo_tick_isr(void *arg);
 
-void _pwm_config_default(servo_config_t *servo_config);
 void _servo_param_set_default(servo_handle_t *servo);
-void _servo_mcpwm_out(servo_handle_t *servo, servo_config_t *servo_config);
+static void _servo_channel_set_default(servo_handle_t *servo);
+static void _servo_nvs_stage(void);
+void _servo_mcpwm_out(servo_handle_t *servo);
 esp_err_t _servo_nvs_save_all(void);
 
 // math function
@@ -168,6 +255,7 @@ esp_err_t robot_set_time(int time_full)
     mutex_lock(servo_lock);
     servo_handler.time_full = time_full;
     servo_handler.time_balance = time_full * 30 / 100;
+    _servo_nvs_stage();
     mutex_unlock(servo_lock);
 
     ESP_LOGI(TAG, "servo set time: %d ms ", time_full);
@@ -178,19 +266,17 @@ esp_err_t robot_set_time(int time_full)
 void _math_lspb_vector_calc(int current_duty, int target_duty, int time_full, int time_balance,
                             math_lspb_vector_t *lspb_vector)
 {
-    const char *TAG = "file: servo_control.c , function: _math_lspb_vector_calc";
-    ESP_LOGD(TAG, "path planning calculating");
-    double tf_ = (double)time_full / SERVO_TIME_STEP;
-    double tb_ = (double)time_balance / SERVO_TIME_STEP;
-    double P0_ = (double)current_duty;
-    double Pf_ = (double)target_duty;
+    robot_real_t tf_ = (robot_real_t)time_full / SERVO_TIME_STEP;
+    robot_real_t tb_ = (robot_real_t)time_balance / SERVO_TIME_STEP;
+    robot_real_t P0_ = (robot_real_t)current_duty;
+    robot_real_t Pf_ = (robot_real_t)target_duty;
 
     if (tf_ <= 0 || tb_ <= 0) {
-        ESP_LOGE(TAG, "tf:%.1lf or tb:%.1lf input is under zero", tf_, tb_);
+        DLOG_F32(DLOG_LSPB_TIME_ZERO, tf_, tb_);
         return;
     }
     if (tf_ < tb_) {
-        ESP_LOGE(TAG, "tf:%.1lf must be > tb:%.1lf", tf_, tb_);
+        DLOG_F32(DLOG_LSPB_TIME_ORDER, tf_, tb_);
     }
 
     // V <= 2 (pf - p0)/tf and V >= (pf - p0)/tf => chon 1.5
@@ -199,66 +285,210 @@ void _math_lspb_vector_calc(int current_duty, int target_duty, int time_full, in
     lspb_vector->Pf = Pf_;
     lspb_vector->tf = (int)tf_;
     lspb_vector->tb = (int)tb_;
-    ESP_LOGD(TAG, "a: %.1lf, P0: %.0lf, Pf: %.0lf, tf: %d, tb: %d", lspb_vector->a, lspb_vector->P0, lspb_vector->Pf,
-             lspb_vector->tf, lspb_vector->tb);
+    DLOG_F32(DLOG_LSPB_CALC, lspb_vector->a, lspb_vector->P0, lspb_vector->Pf, lspb_vector->tf, lspb_vector->tb);
 }
 
-// function path_planning
-int _math_path_planning(double a, double P0, double Pf, int *time_count, int tf, int tb)
+// function path_planning, phase reports the lspb segment of this step
+int _math_path_planning(robot_real_t a, robot_real_t P0, robot_real_t Pf, int *time_count, int tf, int tb,
+                        servo_lspb_phase_t *phase)
 {
-    const char *TAG = "file: servo_control.c , function: _math_path_planning";
-    ESP_LOGD(TAG, "path planning caculate");
+    *phase = SERVO_LSPB_PHASE_IDLE;
     if (a == 0) {
-        ESP_LOGW(TAG, "warning input: a = %.2lf", a);
+        DLOG_F32(DLOG_PLANNING_A_ZERO, a);
         return (int)P0;     // stop
     }
 
-    double temp = 0;
-    double T = (double)(*time_count);
+    robot_real_t temp = 0;
+    robot_real_t T = (robot_real_t)(*time_count);
+    robot_real_t half = 0.5;     // literal would promote the float build to double
     if (T < 0) {
-        ESP_LOGE(TAG, "error T %.0lf", T);
+        DLOG_F32(DLOG_PLANNING_T_ERROR, T);
         return (int)P0;     // stop
     } else if (T <= tb) {
-        temp = P0 + 0.5 * a * T * T;
-        ESP_LOGD(TAG, "velocity up");
+        temp = P0 + half * a * T * T;
+        *phase = SERVO_LSPB_PHASE_ACCEL;
     } else if (T <= (tf - tb)) {
-        temp = P0 + 0.5 * a * (double)tb * (double)tb + a * (double)tb * (T - tb);
-        ESP_LOGD(TAG, "velocity balance");
+        temp = P0 + half * a * (robot_real_t)tb * (robot_real_t)tb + a * (robot_real_t)tb * (T - tb);
+        *phase = SERVO_LSPB_PHASE_CRUISE;
     } else if (T <= tf) {
-        temp = Pf - 0.5 * a * (T - (double)tf) * (T - (double)tf);
-        ESP_LOGD(TAG, "velocity down");
+        temp = Pf - half * a * (T - (robot_real_t)tf) * (T - (robot_real_t)tf);
+        *phase = SERVO_LSPB_PHASE_DECEL;
     } else if (T > tf) {
+        *phase = SERVO_LSPB_PHASE_DONE;
         return (int)Pf;
     }
+    DLOG_I32(DLOG_PLANNING_PHASE, *phase, *time_count);
     (*time_count)++;
     return (int)temp;
 }
 
-// function set duty for a channel with non-locking
-esp_err_t servo_duty_set_lspb_calc(int duty, int channel)
+/*
+ *
+ ********************************************TRAJECTORY HANDOFF*****************************************
+ *
+ */
+// writer fills the buffer the readers do not look at, then moves seq onto it
+static void _handoff_publish(void *buf, size_t size, volatile uint32_t *seq, const void *data)
+{
+    uint32_t next = *seq + 1;
+    memcpy((char *)buf + (next & 1) * size, data, size);
+    __sync_synchronize();
+    *seq = next;
+}
+
+// single attempt, false if the writer published again while copying (the copy may be torn)
+static bool _handoff_read(const void *buf, size_t size, volatile uint32_t *seq, void *data, uint32_t *read_seq)
+{
+    uint32_t begin = *seq;
+    __sync_synchronize();
+    memcpy(data, (const char *)buf + (begin & 1) * size, size);
+    __sync_synchronize();
+    *read_seq = begin;
+    return begin == *seq;
+}
+
+static void _robot_tick_state_read(robot_tick_state_t *state)
+{
+    uint32_t seq;
+    // tick publishes once per SERVO_TIME_STEP, a retry is rare and short
+    while (_handoff_read(tick_state_buf, sizeof(robot_tick_state_t), &tick_state_seq, state, &seq) == false) {
+    }
+}
+
+// motion task only
+static void _servo_tick_state_publish(servo_handle_t *servo)
+{
+    robot_tick_state_t state;
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        state.duty_current[i] = servo->channel[i].duty_current;
+    }
+    state.adopted_seq = tick_adopted_seq;
+    state.status = servo->status;
+    _handoff_publish(tick_state_buf, sizeof(robot_tick_state_t), &tick_state_seq, &state);
+}
+
+// motion task only, pick the last published trajectory up. lspb vectors are made here from the exact
+// duty_current of this tick, so a tick between the planner snapshot and the publish never steps back
+static void _servo_trajectory_adopt(servo_handle_t *servo)
 {
-    const char *TAG = "file: servo_control.c , function: servo_duty_set_lspb_calc";
+    robot_trajectory_t next;
+    uint32_t seq;
+    if (trajectory_seq == tick_adopted_seq) {
+        return;
+    }
+    if (_handoff_read(trajectory_buf, sizeof(robot_trajectory_t), &trajectory_seq, &next, &seq) == false) {
+        return;     // planner is publishing again, take the newer one next tick
+    }
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        if (next.plan_id[i] == trajectory.plan_id[i]) {
+            continue;
+        }
+        _servo_channel_adopt(&servo->channel[i], next.duty_target[i], next.time_full, next.time_balance);
+    }
+    trajectory = next;
+    tick_adopted_seq = seq;
+    robot_trace_trigger();
+    robot_latency_stamp(trajectory.cmd_id, ROBOT_LATENCY_START);
+}
+
+// stage a duty target of one channel in the plan, must be called with servo_lock
+static esp_err_t _robot_plan_channel(int duty, int channel)
+{
+    const char *TAG = "file: servo_control.c , function: _robot_plan_channel";
     if (duty < SERVO_MIN_PULSEWIDTH) {
-        ESP_LOGE(TAG, "duty input is short %d < 500us", duty);
+        ESP_LOGE(TAG, "duty input is short %d < %dus", duty, SERVO_MIN_PULSEWIDTH);
         return ESP_ERR_INVALID_ARG;
     } else if (duty > SERVO_MAX_PULSEWIDTH) {
-        ESP_LOGE(TAG, "duty input is long %d > 2500us", duty);
+        ESP_LOGE(TAG, "duty input is long %d > %dus", duty, SERVO_MAX_PULSEWIDTH);
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (channel < 0 || channel > SERVO_MAX_CHANNEL) {
+    if (channel < 0 || channel >= SERVO_MAX_CHANNEL) {
         ESP_LOGE(TAG, "channel %d is not available", channel);
         return ESP_ERR_INVALID_ARG;
     }
-    servo_handler.channel[channel].duty_target = duty;
-    ESP_LOGD(TAG, "servo %d set duty: %d us ", channel, duty);
+    plan.duty_target[channel] = duty;
+    plan.plan_id[channel]++;
+    DLOG_I32(DLOG_PLAN_CHANNEL, channel, duty);
+    return ESP_OK;
+}
 
-    // step calculation
-    _math_lspb_vector_calc(servo_handler.channel[channel].duty_current, duty, servo_handler.time_full,
-                           servo_handler.time_balance, &servo_handler.channel[channel].lspb);
-    servo_handler.channel[channel].time_count = 0;
+// stage duty[0:num-1] on channels 0 to num-1, all or none, must be called with servo_lock
+static esp_err_t _robot_plan_channels(const int *duty, int num)
+{
+    robot_trajectory_t staged = plan;
+    for (int i = 0; i < num; i++) {
+        esp_err_t err = _robot_plan_channel(duty[i], i);
+        if (err != ESP_OK) {
+            plan = staged;
+            return err;
+        }
+    }
     return ESP_OK;
 }
+
+// hand the plan to the motion task, must be called with servo_lock
+static void _robot_plan_publish(void)
+{
+    plan.time_full = servo_handler.time_full;
+    plan.time_balance = servo_handler.time_balance;
+    plan.cripper_len = servo_handler.cripper_len;
+    plan.cmd_id = plan_cmd_id;
+    // stamped before the publish, the tick on the other core may adopt it right away
+    robot_latency_stamp(plan.cmd_id, ROBOT_LATENCY_IK);
+    // bits of an earlier move, robot_wait_done matches on the sequence anyway
+    xEventGroupClearBits(motion_group, MOTION_DONE_BIT | MOTION_ERROR_BIT);
+    _handoff_publish(trajectory_buf, sizeof(robot_trajectory_t), &trajectory_seq, &plan);
+    // never blocks, a full queue already holds tick events so the timer is running
+    servo_event_t event = {.type = EVENT_SERVO_WAKE};
+    xQueueSend(event_queue, &event, 0);
+}
+
+void robot_set_command_id(int id_command) { plan_cmd_id = id_command; }
+
+esp_err_t robot_wait_done(uint32_t timeout_ms)
+{
+    // the command task is the only publisher, nothing newer comes while it waits
+    uint32_t seq = trajectory_seq;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = timeout_ms / portTICK_RATE_MS;
+    while (1) {
+        // a command without motion, or a move that ended before the wait, is already idle
+        servo_status_t status = robot_get_status();
+        if (status == SERVO_STATUS_IDLE) {
+            return ESP_OK;
+        } else if (status == SERVO_STATUS_ERROR) {
+            return ESP_FAIL;
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            return ESP_ERR_TIMEOUT;
+        }
+        // a done bit set for an older trajectory only costs one more status check
+        EventBits_t bits = xEventGroupWaitBits(motion_group, MOTION_DONE_BIT | MOTION_ERROR_BIT, pdTRUE, pdFALSE,
+                                               timeout - elapsed);
+        if (bits & MOTION_ERROR_BIT) {
+            return ESP_FAIL;
+        }
+        if ((bits & MOTION_DONE_BIT) && (int32_t)(motion_done_seq - seq) >= 0) {
+            return ESP_OK;
+        }
+    }
+}
+
+// function set duty for a channel and start moving it
+esp_err_t servo_duty_set_lspb_calc(int duty, int channel)
+{
+    ROBOT_STATS_BEGIN(stamp);
+    mutex_lock(servo_lock);
+    esp_err_t err = _robot_plan_channel(duty, channel);
+    if (err == ESP_OK) {
+        _robot_plan_publish();
+    }
+    mutex_unlock(servo_lock);
+    ROBOT_STATS_END(ROBOT_STATS_SET_DUTY, stamp);
+    return err;
+}
 /*
  *
  ********************************************SERVO STATUS CHECK*****************************************
@@ -266,50 +496,62 @@ esp_err_t servo_duty_set_lspb_calc(int duty, int channel)
  */
 servo_status_t _servo_channel_check_status(servo_channel_ctrl_t *servo_channel)
 {
-    const char *TAG = "file: servo_control.c , function: _servo_channel_check_status";
     if (servo_channel->duty_current == 0 || servo_channel->duty_target == 0) {
-        ESP_LOGE(TAG, "argument is available. , duty current: %d , duty target: %d", (int)servo_channel->duty_current,
-                 (int)servo_channel->duty_target);
+        DLOG_I32(DLOG_STATUS_ERROR, servo_channel->duty_current, servo_channel->duty_target);
         return SERVO_STATUS_ERROR;
     }
     int sub_duty = abs(servo_channel->duty_current - servo_channel->duty_target);
     if (sub_duty == 0) {
         servo_channel->status = SERVO_STATUS_IDLE;
-        ESP_LOGD(TAG, "CHANNEL SERVO IS IDLE");
+        DLOG_I32(DLOG_STATUS_IDLE, servo_channel->duty_current);
         return SERVO_STATUS_IDLE;
     }
     return SERVO_STATUS_RUNNING;
 }
 
+void _servo_channel_adopt(servo_channel_ctrl_t *servo_channel, int duty_target, int time_full, int time_balance)
+{
+    servo_channel->duty_target = duty_target;
+    _math_lspb_vector_calc(servo_channel->duty_current, duty_target, time_full, time_balance, &servo_channel->lspb);
+    servo_channel->time_count = 0;
+}
+
+servo_status_t _servo_channel_step(servo_channel_ctrl_t *servo_channel, int channel, servo_lspb_phase_t *phase)
+{
+    *phase = SERVO_LSPB_PHASE_IDLE;
+    servo_status_t channel_status = _servo_channel_check_status(servo_channel);
+    if (channel_status != SERVO_STATUS_RUNNING) {
+        return channel_status;
+    }
+    int temp = _math_path_planning(servo_channel->lspb.a, servo_channel->lspb.P0, servo_channel->lspb.Pf,
+                                   &servo_channel->time_count, servo_channel->lspb.tf, servo_channel->lspb.tb, phase);
+    DLOG_I32(DLOG_SET_DUTY_STEP, channel, temp - servo_channel->duty_current, servo_channel->time_count);
+    servo_channel->duty_current = temp;
+
+    if (servo_channel->duty_current < SERVO_MIN_PULSEWIDTH) {
+        servo_channel->duty_current = SERVO_MIN_PULSEWIDTH;
+    }
+    if (servo_channel->duty_current > SERVO_MAX_PULSEWIDTH) {
+        servo_channel->duty_current = SERVO_MAX_PULSEWIDTH;
+    }
+    return SERVO_STATUS_RUNNING;
+}
+
 void _servo_set_duty(servo_handle_t *servo)
 {
-    const char *TAG = "file: servo_control.c , function: _servo_set_duty";
     servo_status_t channel_status;
     int status = 0;
     for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
-        channel_status = _servo_channel_check_status(&servo->channel[i]);
+        servo_lspb_phase_t phase;
+        channel_status = _servo_channel_step(&servo->channel[i], i, &phase);
+        servo_phase[i] = phase;
         if (channel_status == SERVO_STATUS_IDLE) {
         } else if (channel_status == SERVO_STATUS_RUNNING) {
-            int temp = _math_path_planning(servo->channel[i].lspb.a, servo->channel[i].lspb.P0,
-                                           servo->channel[i].lspb.Pf, &servo->channel[i].time_count,
-                                           servo->channel[i].lspb.tf, servo->channel[i].lspb.tb);
-            if (i == 2) {
-                ESP_LOGD(TAG, "step: %d", temp - servo->channel[i].duty_current);
-                ESP_LOGD(TAG, "time_count: %d", servo->channel[i].time_count);
-            }
-            servo->channel[i].duty_current = temp;
-
-            if (servo->channel[i].duty_current < SERVO_MIN_PULSEWIDTH) {
-                servo->channel[i].duty_current = SERVO_MIN_PULSEWIDTH;
-            }
-            if (servo->channel[i].duty_current > SERVO_MAX_PULSEWIDTH) {
-                servo->channel[i].duty_current = SERVO_MAX_PULSEWIDTH;
-            }
             servo->status = SERVO_STATUS_RUNNING;
             status++;
         } else {
             servo->status = SERVO_STATUS_ERROR;
-            ESP_LOGE(TAG, "servo status ERROR");
+            DLOG_I32(DLOG_SET_DUTY_ERROR, i);
             return;
         }
     }
@@ -321,26 +563,34 @@ void _servo_set_duty(servo_handle_t *servo)
     }
 }
 
-servo_status_t robot_get_status() { return servo_handler.status; }
+servo_status_t robot_get_status()
+{
+    robot_tick_state_t state;
+    _robot_tick_state_read(&state);
+    // a published trajectory the tick has not picked up yet is already running for the caller
+    if (state.adopted_seq != trajectory_seq) {
+        return SERVO_STATUS_RUNNING;
+    }
+    return state.status;
+}
 
 void _servo_channel_check_duty_error(servo_channel_ctrl_t *servo_channel)
 {
-    const char *TAG = "file: servo_control.c , function: _servo_channel_check_duty_error";
     // check current duty
     if (servo_channel->duty_current < SERVO_MIN_PULSEWIDTH) {
         servo_channel->duty_current = SERVO_MIN_PULSEWIDTH;
-        ESP_LOGE(TAG, "force current duty is %d ", (int)SERVO_MIN_PULSEWIDTH);
+        DLOG_I32(DLOG_DUTY_FORCE, SERVO_MIN_PULSEWIDTH);
     } else if (servo_channel->duty_current > SERVO_MAX_PULSEWIDTH) {
         servo_channel->duty_current = SERVO_MAX_PULSEWIDTH;
-        ESP_LOGE(TAG, "force current duty is %d ", (int)SERVO_MAX_PULSEWIDTH);
+        DLOG_I32(DLOG_DUTY_FORCE, SERVO_MAX_PULSEWIDTH);
     }
     // check target duty
     if (servo_channel->duty_target < SERVO_MIN_PULSEWIDTH) {
         servo_channel->duty_target = SERVO_MIN_PULSEWIDTH;
-        ESP_LOGE(TAG, "force current duty is %d ", (int)SERVO_MIN_PULSEWIDTH);
+        DLOG_I32(DLOG_DUTY_FORCE, SERVO_MIN_PULSEWIDTH);
     } else if (servo_channel->duty_target > SERVO_MAX_PULSEWIDTH) {
         servo_channel->duty_target = SERVO_MAX_PULSEWIDTH;
-        ESP_LOGE(TAG, "force current duty is %d ", (int)SERVO_MAX_PULSEWIDTH);
+        DLOG_I32(DLOG_DUTY_FORCE, SERVO_MAX_PULSEWIDTH);
     }
 }
 /*
@@ -350,24 +600,24 @@ void _servo_channel_check_duty_error(servo_channel_ctrl_t *servo_channel)
  */
 
 // set pwm out
-void _servo_mcpwm_out(servo_handle_t *servo, servo_config_t *servo_config)
+void _servo_mcpwm_out(servo_handle_t *servo)
 {
-    const char *TAG = "file: servo_control.c , function: _servo_mcpwm_out";
     for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
         _servo_channel_check_duty_error(&servo->channel[i]);
-        if(servo_config[i].unit != MCPWM_UNIT_0) {
-            _pwm_config_default(servo_config);
+        // only channels that moved since the last tick are written
+        if (servo->channel[i].duty_current == servo_duty_written[i]) {
+            continue;
         }
-        esp_err_t error = mcpwm_set_duty_in_us(servo_config[i].unit, servo_config[i].timer, servo_config[i].op,
-                                               servo->channel[i].duty_current);
+        esp_err_t error = robot_hal_pwm_write(i, servo->channel[i].duty_current);
         if( error != ESP_OK) {
-            ESP_LOGE(TAG, "error unit: %d", servo_config[i].unit);
+            DLOG_I32(DLOG_MCPWM_ERROR, i);
             break;
         }
+        servo_duty_written[i] = servo->channel[i].duty_current;
     }
-    ESP_LOGD(TAG, "%d     %d     %d     %d     %d", servo->channel[0].duty_current, servo->channel[1].duty_current,
+    DLOG_I32(DLOG_MCPWM_CURRENT, servo->channel[0].duty_current, servo->channel[1].duty_current,
              servo->channel[2].duty_current, servo->channel[3].duty_current, servo->channel[4].duty_current);
-    ESP_LOGD(TAG, "%d     %d     %d     %d     %d", servo->channel[0].duty_target, servo->channel[1].duty_target,
+    DLOG_I32(DLOG_MCPWM_TARGET, servo->channel[0].duty_target, servo->channel[1].duty_target,
              servo->channel[2].duty_target, servo->channel[3].duty_target, servo->channel[4].duty_target);
 }
 
@@ -377,48 +627,30 @@ void _servo_mcpwm_out(servo_handle_t *servo, servo_config_t *servo_config)
  *
  */
 
-void IRAM_ATTR _timer_group0_isr(void *para)
+// tick callback of robot_hal, interrupt context on target
+static bool IRAM_ATTR _servo_tick_isr(void *arg)
 {
-    TIMERG0.hw_timer[0].update = 1;
-    TIMERG0.int_clr_timers.t0 = 1;
-    event_type_t event_handler = EVENT_TIMER_SERVO;
-    xQueueSendFromISR(event_queue, &event_handler, NULL);
-    TIMERG0.hw_timer[0].config.alarm_en = TIMER_ALARM_EN;
+    BaseType_t woken = pdFALSE;
+    servo_event_t event = {
+        .type = EVENT_TIMER_SERVO,
+        .seq = ++tick_isr_seq,
+        .stamp = esp_timer_get_time(),
+    };
+    xQueueSendFromISR(event_queue, &event, &woken);
     if (nvs_time_save-- == 0) {
         nvs_time_save = NVS_SAVE_TIME;
-        event_handler = EVENT_NVS_SAVE;
-        xQueueSendFromISR(event_queue, &event_handler, NULL);
+        event.type = EVENT_NVS_SAVE;
+        xQueueSendFromISR(event_queue, &event, &woken);
     }
+    return woken == pdTRUE;
 }
 
-static void _timer_init(bool auto_reload, double timer_interval, const int TIMER_SCALE)
+static void _timer_init(uint32_t period_ms)
 {
     const char *TAG = "file: servo_control.c , function: _timer_init";
-    /* Select and initialize basic parameters of the timer */
-    timer_config_t config = {
-        .divider = TIMER_DIVIDER,
-        .counter_dir = TIMER_COUNT_UP,
-        .counter_en = TIMER_PAUSE,
-        .alarm_en = TIMER_ALARM_EN,
-        .intr_type = TIMER_INTR_LEVEL,
-        .auto_reload = auto_reload,
-    };
-    ESP_ERROR_CHECK(timer_init(TIMER_GROUP_0, TIMER_0, &config));
-
-    /* Timer's counter will initially start from value below.
-       Also, if auto_reload is set, this value will be automatically reload on
-       alarm */
-    timer_set_counter_value(TIMER_GROUP_0, TIMER_0, 0x00000000ULL);
-
-    /* Configure the alarm value and the interrupt on alarm. */
-    timer_set_alarm_value(TIMER_GROUP_0, TIMER_0, timer_interval * TIMER_SCALE);
-
-    timer_enable_intr(TIMER_GROUP_0, TIMER_0);
-    ESP_ERROR_CHECK(
-        timer_isr_register(TIMER_GROUP_0, TIMER_0, _timer_group0_isr, (void *)TIMER_0, ESP_INTR_FLAG_IRAM, NULL));
-
-    ESP_ERROR_CHECK(timer_start(TIMER_GROUP_0, TIMER_0));
-    ESP_LOGI(TAG, "timer isr init %d ms: OK", (int)timer_interval);
+    ESP_ERROR_CHECK(robot_hal_tick_init(period_ms, _servo_tick_isr, NULL));
+    robot_hal_tick_start();
+    ESP_LOGI(TAG, "timer isr init %d ms: OK", (int)period_ms);
 }
 
 /*
@@ -427,59 +659,11 @@ static void _timer_init(bool auto_reload, double timer_interval, const int TIMER
  *
  */
 
-// assign config parameter
-void _pwm_config_default(servo_config_t *servo_config)
-{
-    const char *TAG = "file: servo_control.c , function: _pwm_config_default";
-    memset(servo_config, 0, 6 * sizeof(servo_config_t));
-
-    servo_config[0].unit = MCPWM_UNIT_0;
-    servo_config[0].timer = MCPWM_TIMER_0;
-    servo_config[0].io_signal = MCPWM0A;
-    servo_config[0].op = MCPWM_OPR_A;
-    servo_config[0].pinnum = SERVO_PINNUM_0;
-
-    servo_config[1].unit = MCPWM_UNIT_0;
-    servo_config[1].timer = MCPWM_TIMER_0;
-    servo_config[1].io_signal = MCPWM0B;
-    servo_config[1].op = MCPWM_OPR_B;
-    servo_config[1].pinnum = SERVO_PINNUM_1;
-
-    // timer 1, 2channel
-    servo_config[2].unit = MCPWM_UNIT_0;
-    servo_config[2].timer = MCPWM_TIMER_1;
-    servo_config[2].io_signal = MCPWM1A;
-    servo_config[2].op = MCPWM_OPR_A;
-    servo_config[2].pinnum = SERVO_PINNUM_2;
-
-    servo_config[3].unit = MCPWM_UNIT_0;
-    servo_config[3].timer = MCPWM_TIMER_1;
-    servo_config[3].io_signal = MCPWM1B;
-    servo_config[3].op = MCPWM_OPR_B;
-    servo_config[3].pinnum = SERVO_PINNUM_3;
-
-    // timer 2, 2 channel
-    servo_config[4].unit = MCPWM_UNIT_0;
-    servo_config[4].timer = MCPWM_TIMER_2;
-    servo_config[4].io_signal = MCPWM2A;
-    servo_config[4].op = MCPWM_OPR_A;
-    servo_config[4].pinnum = SERVO_PINNUM_4;
-
-    servo_config[5].unit = MCPWM_UNIT_0;
-    servo_config[5].timer = MCPWM_TIMER_2;
-    servo_config[5].io_signal = MCPWM2B;
-    servo_config[5].op = MCPWM_OPR_B;
-    servo_config[5].pinnum = SERVO_PINNUM_5;
-    ESP_LOGI(TAG, "servo's 6 channels are assigned:  OK");
-}
-
-// assign parameter of servo handle
-void _servo_param_set_default(servo_handle_t *servo)
+// home pose and idle state of every channel, calibration is kept
+static void _servo_channel_set_default(servo_handle_t *servo)
 {
-    memset(servo, 0, sizeof(servo_handle_t));
-    int home[6] = {1500, 1050, 1980, 2100, 1500, 1900};
-    int upper[5] = {1970, 2100, 1980, 2100, 2000};
-    int under[5] = {950, 1050, 800, 1020, 1000};
+    int home[SERVO_MAX_CHANNEL] = SERVO_HOME_DUTY;
+    memset(servo->channel, 0, sizeof(servo->channel));
     for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
         servo->channel[i].duty_current = home[i];
         servo->channel[i].duty_target = home[i];
@@ -491,6 +675,16 @@ void _servo_param_set_default(servo_handle_t *servo)
         servo->channel[i].lspb.tf = 0;
         servo->channel[i].time_count = 0;
     }
+    servo->status = SERVO_STATUS_IDLE;
+}
+
+// assign parameter of servo handle
+void _servo_param_set_default(servo_handle_t *servo)
+{
+    memset(servo, 0, sizeof(servo_handle_t));
+    int upper[5] = {1970, 2100, 1980, 2100, 2000};
+    int under[5] = {950, 1050, 800, 1020, 1000};
+    _servo_channel_set_default(servo);
     // non cripper
     for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
         servo->duty_calib[i].scale = 1;
@@ -498,10 +692,8 @@ void _servo_param_set_default(servo_handle_t *servo)
         servo->duty_calib[i].under_limit = under[i];
         servo->duty_calib[i].upper_limit = upper[i];
     }
-    servo->status = SERVO_STATUS_IDLE;
     servo->time_full = 2000;       // ms
     servo->time_balance = 800;     // ms
-    servo->nvs_magic = SERVO_NVS_MAGIC;
     servo->cripper_len = 5.84;
 }
 /*
@@ -509,12 +701,134 @@ void _servo_param_set_default(servo_handle_t *servo)
  ****************************************SERVO RUN TASK********************************************
  *
  */
+// motion task only
+static void _servo_trace_record(servo_handle_t *servo)
+{
+#if CONFIG_ROBOT_TRACE_ENABLE
+    if (robot_trace_get_state() == ROBOT_TRACE_STOPPED) {
+        return;
+    }
+    int duty_current[SERVO_MAX_CHANNEL], duty_target[SERVO_MAX_CHANNEL];
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        duty_current[i] = servo->channel[i].duty_current;
+        duty_target[i] = servo->channel[i].duty_target;
+    }
+    robot_trace_record((uint32_t)(esp_timer_get_time() / 1000), duty_current, duty_target, servo_phase);
+#endif
+}
+
+// one motion step, motion task only
+static void _servo_tick(void)
+{
+    ROBOT_STATS_BEGIN(stamp);
+    robot_stats_gauge(ROBOT_STATS_EVENT_QUEUE, uxQueueMessagesWaiting(event_queue));
+    _servo_trajectory_adopt(&servo_handler);
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        _servo_channel_check_duty_error(&servo_handler.channel[i]);
+    }
+    _servo_set_duty(&servo_handler);
+    _servo_mcpwm_out(&servo_handler);
+    // before the state is published, the command side sends DONE as soon as it reads idle
+    if (servo_handler.status == SERVO_STATUS_IDLE) {
+        robot_latency_stamp(trajectory.cmd_id, ROBOT_LATENCY_END);
+    }
+    _servo_tick_state_publish(&servo_handler);
+    _servo_trace_record(&servo_handler);
+    ROBOT_STATS_END(ROBOT_STATS_TICK, stamp);
+    if (servo_handler.status == SERVO_STATUS_ERROR) {
+        xEventGroupSetBits(motion_group, MOTION_ERROR_BIT);
+    }
+
+    // every channel idle and nothing left to adopt => stop the timer until the next wake event
+    // a trajectory published after this check posts its wake event behind us, so it is never lost
+    if (servo_handler.status == SERVO_STATUS_IDLE && trajectory_seq == tick_adopted_seq) {
+        robot_hal_tick_pause();
+        tick_suspended = true;
+        // state is already published, robot_get_status agrees with the waiter
+        motion_done_seq = tick_adopted_seq;
+        xEventGroupSetBits(motion_group, MOTION_DONE_BIT);
+        // arm is at rest, good time to persist
+        int duty_target[SERVO_MAX_CHANNEL];
+        for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+            duty_target[i] = servo_handler.channel[i].duty_target;
+        }
+        robot_journal_append(duty_target, trajectory.cripper_len);
+        servo_event_t event = {.type = EVENT_NVS_SAVE};
+        xQueueSend(event_queue, &event, 0);
+    }
+}
+
+static void _servo_tick_resume(void)
+{
+    tick_suspended = false;
+    robot_hal_tick_start();
+}
+
+// check a timer tick against its isr stamp, return how many motion steps it is worth
+// 0 => stale tick dropped, > 1 => ticks lost on a full queue are caught up
+static int _servo_tick_deadline(const servo_event_t *event)
+{
+    uint32_t late = (uint32_t)(esp_timer_get_time() - event->stamp);
+    uint32_t missed = event->seq - tick_last_seq - 1;
+    tick_last_seq = event->seq;
+    int steps = 1;
+#if CONFIG_ROBOT_TICK_POLICY_DROP_STALE
+    // a newer tick is already due, this one would only make a burst
+    if (late >= SERVO_TIME_STEP * 1000) {
+        steps = 0;
+    }
+#else
+    steps += missed;
+#endif
+    portENTER_CRITICAL(&tick_stats_mux);
+    tick_stats.tick++;
+    tick_stats.missed += missed;
+    if (late > ROBOT_TICK_LATE_US) {
+        tick_stats.late++;
+    }
+    if (late > tick_stats.worst_late_us) {
+        tick_stats.worst_late_us = late;
+    }
+    if (steps == 0) {
+        tick_stats.dropped++;
+    }
+    portEXIT_CRITICAL(&tick_stats_mux);
+    return steps;
+}
+
+esp_err_t robot_get_tick_stats(robot_tick_stats_t *stats)
+{
+    portENTER_CRITICAL(&tick_stats_mux);
+    *stats = tick_stats;
+    portEXIT_CRITICAL(&tick_stats_mux);
+    return ESP_OK;
+}
+
+void robot_reset_tick_stats(void)
+{
+    portENTER_CRITICAL(&tick_stats_mux);
+    memset(&tick_stats, 0, sizeof(tick_stats));
+    portEXIT_CRITICAL(&tick_stats_mux);
+}
+
 static void _servo_run_task(void *arg)
 {
     const char *TAG = "file: servo_control.c , function: _SERVO_RUN_TASK";
-    ESP_LOGI(TAG, "servo_run_task start ...");
-    // check duty
-    _servo_param_set_default(&servo_handler);
+    ESP_LOGI(TAG, "servo_run_task start on core %d ...", xPortGetCoreID());
+    // channels were set up by servo_init, at the journaled pose or at home
+    // seed the plan with the pose the tick starts from, nothing is published yet
+    mutex_lock(servo_lock);
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        plan.duty_target[i] = servo_handler.channel[i].duty_target;
+    }
+    plan.cripper_len = servo_handler.cripper_len;
+    trajectory = plan;
+    mutex_unlock(servo_lock);
+    _servo_tick_state_publish(&servo_handler);
+    // timer isr is allocated on the core that registers it, keep it next to this task
+    robot_boot_begin(ROBOT_BOOT_TIMER);
+    _timer_init(SERVO_TIME_STEP);
+    robot_boot_end(ROBOT_BOOT_TIMER);
     // for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
     //     if (servo_handler.channel[i].duty_current != servo_handler.channel[i].duty_target) {
     //         _servo_param_set_default(&servo_handler);
@@ -522,58 +836,97 @@ static void _servo_run_task(void *arg)
     //     }
     // }
     while (1) {
-        event_type_t event_handler;
-        if (xQueueReceive(event_queue, &event_handler, portMAX_DELAY)) {
-            if (event_handler == EVENT_TIMER_SERVO) {
-                ESP_LOGD(TAG, "EVENT SERVO RUN");
-                mutex_lock(servo_lock);
-                for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
-                    _servo_channel_check_duty_error(&servo_handler.channel[i]);
+        servo_event_t event;
+        if (xQueueReceive(event_queue, &event, portMAX_DELAY)) {
+            if (event.type == EVENT_TIMER_SERVO) {
+                DLOG_I32(DLOG_SERVO_RUN, event.seq);
+                int steps = _servo_tick_deadline(&event);
+                // a tick queued just before the timer was paused is dropped
+                for (int i = 0; i < steps && tick_suspended == false; i++) {
+                    _servo_tick();
+                }
+                robot_hal_tick_done();
+            } else if (event.type == EVENT_SERVO_WAKE) {
+                // while running the next timer tick adopts the trajectory, an extra tick would speed it up
+                if (tick_suspended) {
+                    DLOG_I32(DLOG_SERVO_WAKE, trajectory_seq);
+                    _servo_tick_resume();
+                    _servo_tick();
+                }
+            } else if (event.type == EVENT_NVS_SAVE) {
+                // only when a parameter changed and the arm is at rest. the save is a snapshot, the flash
+                // write that follows in STORAGE-TASK still stalls both cores while the cache is off
+                if (servo_nvs_dirty && tick_suspended) {
+                    _servo_nvs_save_all();
                 }
-                _servo_set_duty(&servo_handler);
-                _servo_mcpwm_out(&servo_handler, servo_config_pv);
-                mutex_unlock(servo_lock);
-            } else if (event_handler == EVENT_NVS_SAVE) {
-                // _servo_nvs_save_all();
             }
         }
-        vTaskDelay(1 / portTICK_RATE_MS);
     }
 }
 /*
 *********************************SERVO INIT**********************************
 */
 
-void servo_init(void)
+// start every channel idle at the last journaled pose, the first tick writes it to mcpwm as is
+// so the arm does not move at boot. home pose when the journal is empty
+static void _servo_boot_pose(void)
 {
-    const char *TAG = "file: servo_control.c , function: servo_init";
-    // servo_config_t *servo_config_pv = (servo_config_t *)calloc(6, sizeof(servo_config_t));
-    _pwm_config_default(servo_config_pv);
-    // timer 0,  2 channel
-
-    mcpwm_config_t pwm_config;
-    pwm_config.frequency = 50;     // frequency = 50Hz, i.e. for every servo
-    // time period should be 20ms
-    pwm_config.cmpr_a = 0;     // duty cycle of PWMxA = 0
-    pwm_config.cmpr_b = 0;     // duty cycle of PWMxb = 0
-    pwm_config.counter_mode = MCPWM_UP_COUNTER;
-    pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
-
+    const char *TAG = "file: servo_control.c , function: _servo_boot_pose";
+    int duty[SERVO_MAX_CHANNEL];
+    double cripper_len;
+    _servo_channel_set_default(&servo_handler);
+    // writer runs on the command core below every robot task, like the storage task
+    robot_boot_begin(ROBOT_BOOT_JOURNAL);
+    esp_err_t err = robot_journal_init(ROBOT_COMM_TASK_CORE, 1);
+    robot_boot_end(ROBOT_BOOT_JOURNAL);
+    if (err != ESP_OK || robot_journal_last(duty, &cripper_len) != ESP_OK) {
+        ESP_LOGI(TAG, "no journaled pose, start at home");
+        return;
+    }
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        if (duty[i] < SERVO_MIN_PULSEWIDTH || duty[i] > SERVO_MAX_PULSEWIDTH) {
+            ESP_LOGW(TAG, "journaled duty[%d] = %d out of range, start at home", i, duty[i]);
+            return;
+        }
+    }
     for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
-        ESP_ERROR_CHECK(
-            mcpwm_gpio_init(servo_config_pv[i].unit, servo_config_pv[i].io_signal, servo_config_pv[i].pinnum));
-        ESP_ERROR_CHECK(mcpwm_init(servo_config_pv[i].unit, servo_config_pv[i].timer, &pwm_config));
+        servo_handler.channel[i].duty_current = duty[i];
+        servo_handler.channel[i].duty_target = duty[i];
     }
+    servo_handler.cripper_len = cripper_len;
+    ESP_LOGI(TAG, "start at journaled pose %d %d %d %d %d %d", duty[0], duty[1], duty[2], duty[3], duty[4], duty[5]);
+}
 
+void servo_init(void)
+{
+    const char *TAG = "file: servo_control.c , function: servo_init";
+    robot_boot_begin(ROBOT_BOOT_MCPWM);
+    // 50 Hz, output stays low until the first tick writes the start pose
+    ESP_ERROR_CHECK(robot_hal_pwm_init(servo_pin, SERVO_MAX_CHANNEL));
+    robot_boot_end(ROBOT_BOOT_MCPWM);
     ESP_LOGI(TAG, "servo 6 channels config:  OK");
 
+    // formatter runs on the command core below every robot task
+    dlog_init(ROBOT_COMM_TASK_CORE, 1);
     nvs_time_save = NVS_SAVE_TIME;
-    _timer_init(TIMER_AUTO_RELOAD, SERVO_TIME_STEP, TIMER_SCALE_MS);
-    event_queue = xQueueCreate(20, sizeof(event_type_t));
+    event_queue = xQueueCreate(ROBOT_EVENT_QUEUE_DEPTH, sizeof(servo_event_t));
+    motion_group = xEventGroupCreate();
     servo_lock = mutex_create();
+#if IK_CACHE_SIZE > 0
+    ik_cache_config_t ik_cache_cfg = {
+        .size = IK_CACHE_SIZE,
+        .resolution = IK_CACHE_RESOLUTION,
+    };
+    ik_cache_handle = ik_cache_init(&ik_cache_cfg);
+#endif
+    robot_trace_init(ROBOT_TRACE_DEPTH);
     servo_nvs_load();
     // _servo_param_set_default(&servo_handler);
-    xTaskCreate(_servo_run_task, "_SERVO_RUN_TASK", 8 * 1024, NULL, 5, NULL);
+    _servo_boot_pose();
+    TaskHandle_t servo_task = NULL;
+    xTaskCreatePinnedToCore(_servo_run_task, "_SERVO_RUN_TASK", 8 * 1024, NULL, ROBOT_MOTION_TASK_PRIORITY,
+                            &servo_task, ROBOT_MOTION_TASK_CORE);
+    robot_stats_add_task(servo_task);
 }
 
 /*
@@ -630,7 +983,7 @@ bool _math_in_workspace(double d, double z, double theta, double r1, double r2,
     // = false if point is in workspace
     bool check4 = _math_in_circle(d, z, dtemp, ztemp, Rtemp);
 
-    if (~check1 & check2 & check3 & ~check4) {
+    if (!check1 && check2 && check3 && !check4) {
         return true;
     }
     return false;
@@ -654,91 +1007,125 @@ double _math_scale(double arg, double scale, double bias, double under_limit, do
  * ***************************************Kinetic Calculate funciton**********************************************
  *
  */
-// preprocess to put x y z position
-// function return pointer of xyzther3 array
-esp_err_t robot_set_position(double x, double y, double z)
+// solve one branch of the position ik for a given theta[1], elbow = -1 is the elbow down solution
+// duty[0:4] is output, return ESP_ERR_INVALID_ARG when a joint is out of its limit
+static esp_err_t _robot_ik_position_branch(double d, double z, double theta0, double theta1, int elbow, double a2,
+                                           double a3, double a4, int *duty)
 {
-    // static double a = 1.0, d = 0.0, d1 = 8.7, a2 = 10.5, a3 = 10.0, d5 = 20.5;
-    const char *TAG = "file: servo_control.c , function: robot_set_position";
-    ESP_LOGI(TAG, "position set: x: %.2lf, y: %.2lf, z: %.2lf", x, y, z);
-    mutex_lock(servo_lock);
-    z = z - 8.7;
-    y = y + 7.94;
     double theta[5];
-    double a1 = 0.915 ; // O0 to O1
-    double a2 = 10.225, a3 = 9.7;
-    double a4 = 14.6 + servo_handler.cripper_len;
-    double d = sqrt(x * x + y * y) - a1;     // z = 0;
-
-    theta[0] = atan2d(y, x);     // + atan2d(d, r);
-    theta[1] = 90;
-    while (_math_in_workspace(d, z, theta[1], a2, a3, a4) == false) {
-        theta[1]--;
-        if (theta[1] == 0) {
-            ESP_LOGE(TAG, "position is out of workspace");
-            mutex_unlock(servo_lock);
-            return ESP_ERR_INVALID_ARG;
-        }
-    }
-
+    theta[0] = theta0;
+    theta[1] = theta1;
     double z2 = a2 * sind(theta[1]);
     double d2 = a2 * cosd(theta[1]);
     double r24 = sqrt((z - z2) * (z - z2) + (d - d2) * (d - d2));
     double c4 = (r24 * r24 - a3 * a3 - a4 * a4) / (2 * a3 * a4);
-    double s4 = sqrt(1 - c4 * c4);
+    double s4 = elbow * sqrt(1 - c4 * c4);
     // theta[3] < 0 => clockwise, -135 => -45
-    theta[3] = atan2d(-s4, c4);
+    theta[3] = atan2d(s4, c4);
     // theta[2] < 0 => clockwise
     double phi = acosd((r24 * r24 + a3 * a3 - a4 * a4) / (2 * r24 * a3));     // 0 => 180
     double alpha = atan2d(z - z2, d - d2);                                    // -90 => 90
-    theta[2] = -(theta[1] - phi - alpha);                                     // => theta[2]: -90 => 180
+    theta[2] = -(theta[1] + elbow * phi - alpha);                             // => theta[2]: -90 => 180
     // theta[4]
     theta[4] = 45;
 
     // convert arguments
-    ESP_LOGI(TAG, "theta:  theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
+    DLOG_F32(DLOG_IK_THETA_RAW, theta[0], theta[1], theta[2], theta[3], theta[4]);
     theta[0] = _math_scale(theta[0], 1, -45, 0, 90);     // real [1000:2000] us = [45:135] => 0: 90
     theta[1] = _math_scale(theta[1], -1, 90, 0, 90);     // real [1000:2000] us = [90:0]   => 0: 90
     theta[2] = _math_scale(theta[2], 1, 90, 0, 90);      // real [1000:2000] us = [-90:0]  => 0: 90
     theta[3] = _math_scale(theta[3], 1, 135, 0, 90);     // real [1000:2000] us = [-135:-45] => 0: 90
     theta[4] = _math_scale(theta[4], 1, 0, 0, 90);       // real [1000:2000] us = [0:90] => 0: 90
-    ESP_LOGD(TAG, "scale off: theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
     // convert to duty
-    int duty[5];
     for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
-        if (theta[i] == -1) {
-            ESP_LOGE(TAG, "theta [%d] == -1", i);
-            mutex_unlock(servo_lock);
+        if (theta[i] == -1 || isnan(theta[i])) {
+            DLOG_I32(DLOG_IK_THETA_INVALID, i);
             return ESP_ERR_INVALID_ARG;
         }
         duty[i] = _math_deg2duty(theta[i], servo_handler.duty_calib[i]);
     }
-    ESP_LOGI(TAG, "duty : duty[0]: %d, duty[1]: %d, duty[2]: %d, duty[3]: %d, duty[4]: %d", duty[0],
-             duty[1], duty[2], duty[3], duty[4]);
+    return ESP_OK;
+}
 
-    // set duty to run servo
-    // i = SERVO_CHANNEL_[I]
+// cost of moving from duty vector "from" to "duty" with the configured criteria
+static double _robot_ik_select_cost(const int *duty, const int *from)
+{
+    double distance = 0, time = 0;
     for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
-        servo_duty_set_lspb_calc(duty[i], i);
+        int step = abs(duty[i] - from[i]);
+        distance += ik_select.weight[i] * step;
+        if (step / ik_select.speed[i] > time) {
+            time = step / ik_select.speed[i];
+        }
     }
-    // set time to zero
-    mutex_unlock(servo_lock);
+    if (ik_select.mode == ROBOT_IK_SELECT_MIN_TIME) {
+        // slowest joint sets the move time, distance only breaks ties
+        return time + distance * 1e-3;
+    }
+    return distance;
+}
+
+// solve ik with theta[1] searched inside workspace, wrist is fixed at 45 degree
+// ROBOT_IK_SELECT_FIRST is the legacy solver: the first theta[1] inside workspace from 90 degree down, elbow down
+// only, and an error when that branch breaks a joint limit. Other modes rank every feasible theta[1]/elbow
+// solution with ik_select against duty vector "from"
+// duty[0:4] is output, servo_handler is not touched
+static esp_err_t _robot_ik_position(double x, double y, double z, double cripper_len, const int *from, int *duty)
+{
+    // static double a = 1.0, d = 0.0, d1 = 8.7, a2 = 10.5, a3 = 10.0, d5 = 20.5;
+    z = z - 8.7;
+    y = y + 7.94;
+    double a1 = 0.915 ; // O0 to O1
+    double a2 = 10.225, a3 = 9.7;
+    double a4 = 14.6 + cripper_len;
+    double d = sqrt(x * x + y * y) - a1;     // z = 0;
+    double theta0 = atan2d(y, x);     // + atan2d(d, r);
+
+    int candidate[SERVO_MAX_CHANNEL - 1];
+    double best_cost = -1, best_theta1 = 0;
+    for (double theta1 = 90; theta1 > 0; theta1--) {
+        if (_math_in_workspace(d, z, theta1, a2, a3, a4) == false) {
+            continue;
+        }
+        if (ik_select.mode == ROBOT_IK_SELECT_FIRST) {
+            if (_robot_ik_position_branch(d, z, theta0, theta1, -1, a2, a3, a4, duty) != ESP_OK) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            best_cost = 0;
+            best_theta1 = theta1;
+            break;
+        }
+        for (int elbow = -1; elbow <= 1; elbow += 2) {
+            if (_robot_ik_position_branch(d, z, theta0, theta1, elbow, a2, a3, a4, candidate) != ESP_OK) {
+                continue;
+            }
+            double cost = _robot_ik_select_cost(candidate, from);
+            if (best_cost < 0 || cost < best_cost) {
+                best_cost = cost;
+                best_theta1 = theta1;
+                memcpy(duty, candidate, sizeof(candidate));
+            }
+        }
+    }
+    if (best_cost < 0) {
+        DLOG_F32(DLOG_IK_OUT_OF_WORKSPACE, d, z);
+        return ESP_ERR_INVALID_ARG;
+    }
+    DLOG_F32(DLOG_IK_THETA, best_theta1, best_cost);
+    DLOG_I32(DLOG_IK_DUTY, duty[0], duty[1], duty[2], duty[3], duty[4]);
     return ESP_OK;
 }
 
-esp_err_t robot_set_position_with_angle(double x, double y, double z, double angle)
+// solve ik with the cripper kept vertical and wrist angle given
+// duty[0:4] is output, servo_handler is not touched
+static esp_err_t _robot_ik_position_angle(double x, double y, double z, double angle, double cripper_len, int *duty)
 {
-    const char *TAG = __func__;     //__func__
-    ESP_LOGI(TAG, "position set: x: %.2lf, y: %.2lf, z: %.2lf", x, y, z);
-    mutex_lock(servo_lock);
     z = z - 8.7;
     y = y + 7.94;
     double theta[5];
     double a1 = 0.915;     // O0 to O1
     double a2 = 10.225, a3 = 9.7;
-    double a4 = 14.6 + servo_handler.cripper_len;
+    double a4 = 14.6 + cripper_len;
 
     double d = sqrt(x * x + y * y) - a1;     // z = 0;
     theta[0] = atan2d(y, x);
@@ -746,8 +1133,7 @@ esp_err_t robot_set_position_with_angle(double x, double y, double z, double ang
     double z_ = z + a4;
     double a23 = sqrt( z_*z_ + d*d );
     if( a23 > a2 + a3) {
-        ESP_LOGE(TAG, "a23 > a2 + a3 ");
-        mutex_unlock(servo_lock);
+        DLOG_F32(DLOG_IK_ANGLE_REACH, a23, a2 + a3);
         return ESP_ERR_INVALID_ARG;
     }
 
@@ -758,8 +1144,7 @@ esp_err_t robot_set_position_with_angle(double x, double y, double z, double ang
     // theta[2]
     double beta = acosd( (a2*a2 + a3*a3 - a23*a23) / (2*a2*a3));
     if( beta < 90) {
-        ESP_LOGE(TAG, "beta %lf  < 90", beta);
-        mutex_unlock(servo_lock);
+        DLOG_F32(DLOG_IK_ANGLE_BETA, beta);
         return ESP_ERR_INVALID_ARG;
     }
     theta[2] = -(180.0 - beta);        // theta[2] [0:90]
@@ -770,254 +1155,396 @@ esp_err_t robot_set_position_with_angle(double x, double y, double z, double ang
     theta[4] = angle;
 
     // convert arguments
-    ESP_LOGI(TAG, "theta:  theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
+    DLOG_F32(DLOG_IK_THETA_ANGLE, theta[0], theta[1], theta[2], theta[3], theta[4]);
     theta[0] = _math_scale(theta[0], 1, -45, 0, 90);     // real [1000:2000] us = [45:135] => 0: 90
     theta[1] = _math_scale(theta[1], -1, 90, 0, 90);     // real [1000:2000] us = [90:0]   => 0: 90
     theta[2] = _math_scale(theta[2], 1, 90, 0, 90);      // real [1000:2000] us = [-90:0]  => 0: 90
     theta[3] = _math_scale(theta[3], 1, 135, 0, 90);     // real [1000:2000] us = [-135:-45] => 0: 90
     theta[4] = _math_scale(theta[4], 1, 0, 0, 90);       // real [1000:2000] us = [0:90] => 0: 90
-    ESP_LOGD(TAG, "scale off: theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
+    DLOG_F32(DLOG_IK_THETA_SCALED, theta[0], theta[1], theta[2], theta[3], theta[4]);
     // convert to duty
-    int duty[5];
     for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
         if (theta[i] == -1) {
-            ESP_LOGE(TAG, "theta [%d] == -1", i);
-            mutex_unlock(servo_lock);
+            DLOG_I32(DLOG_IK_ANGLE_THETA_INVALID, i);
             return ESP_ERR_INVALID_ARG;
         }
         duty[i] = _math_deg2duty(theta[i], servo_handler.duty_calib[i]);
     }
-    ESP_LOGI(TAG, "duty : duty[0]: %d, duty[1]: %d, duty[2]: %d, duty[3]: %d, duty[4]: %d", duty[0],
-             duty[1], duty[2], duty[3], duty[4]);
-
-    // set duty to run servo
-    // i = SERVO_CHANNEL_[I]
-    for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
-        servo_duty_set_lspb_calc(duty[i], i);
-    }
-    // set time to zero
-    mutex_unlock(servo_lock);
+    DLOG_I32(DLOG_IK_DUTY, duty[0], duty[1], duty[2], duty[3], duty[4]);
     return ESP_OK;
 }
 
-esp_err_t robot_set_home()
+// copy what the ik reads, must be called with servo_lock
+// duty_current comes from the tick state, duty_target from the plan
+static void _robot_snapshot(robot_snapshot_t *snapshot)
 {
-    int home[5] = {1500, 1050, 1980, 2100, 1500};
-    for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
-        servo_duty_set_lspb_calc(home[i], i);
-    }
-    return ESP_OK;
+    robot_tick_state_t state;
+    _robot_tick_state_read(&state);
+    memcpy(snapshot->duty_current, state.duty_current, sizeof(snapshot->duty_current));
+    memcpy(snapshot->duty_target, plan.duty_target, sizeof(snapshot->duty_target));
+    snapshot->cripper_len = servo_handler.cripper_len;
+    snapshot->time_full = servo_handler.time_full;
 }
 
-/************************************* CRIPPER WIDE WITH PULSE *********************************************
- * PULSE (us)    1900    1800    1700    1600    1500    1400    1300    1200    1100
- *------------------------------------------------------------------------------------
- * WIDE  (cm)    0.97    1.41    2.40    3.65    4.39    5.00    5.43    5.84    5.96
- *------------------------------------------------------------------------------------
- * ADD-LENG(cm)  5.84    5.76    5.54    5.19    4.80    4.38    3.87    3.35    3.01
- */
+// look the target up in ik cache before solving, "from" is the duty_current vector the move starts at
+// only duty[0:4] is solved and cached, duty[5] (cripper) is left as the caller filled it
+// use_cache = false solves without touching the cache, dry runs must not evict the poses the arm moves to
+static esp_err_t _robot_ik_cached(robot_ik_kind_t kind, double x, double y, double z, double angle, double width,
+                                  double cripper_len, const int *from, bool use_cache, int *duty)
+{
+    if (use_cache == false) {
+        if (kind == ROBOT_IK_POSITION_ANGLE) {
+            return _robot_ik_position_angle(x, y, z, angle, cripper_len, duty);
+        }
+        return _robot_ik_position(x, y, z, cripper_len, from, duty);
+    }
 
-#define ROBOT_CRIPPER_MAX_WIDTH (6.0)
-#define ROBOT_CRIPPER_MIN_WIDTH (2.0)
+    int32_t from_hash = 0;
+    // solution depends on where the arm is when theta[1] is selected by travel
+    if (kind == ROBOT_IK_POSITION && ik_select.mode != ROBOT_IK_SELECT_FIRST) {
+        uint32_t hash = 2166136261u;     // fnv-1a
+        for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
+            hash = (hash ^ (uint32_t)(from[i] / IK_CACHE_FROM_STEP)) * 16777619u;
+        }
+        from_hash = (int32_t)hash;
+    }
 
-// error +-1cm , this function caculate base on reels data.
-int _width2duty(double width)
-{
-    const char *TAG = "file: servo_control.c , function: _width2duty";
-    if (width < ROBOT_CRIPPER_MIN_WIDTH || width > ROBOT_CRIPPER_MAX_WIDTH) {
-        ESP_LOGE(TAG, "width is: %.1lf out of range [%.1lf:%.1lf]", width, ROBOT_CRIPPER_MIN_WIDTH,
-                 ROBOT_CRIPPER_MAX_WIDTH);
-        return 0;
+    ik_cache_key_t key;
+    ik_cache_make_key(ik_cache_handle, &key, kind, x, y, z, angle, width, cripper_len, from_hash);
+    if (ik_cache_lookup(ik_cache_handle, &key, duty) == ESP_OK) {
+        DLOG_I32(DLOG_IK_CACHE_HIT, kind);
+        return ESP_OK;
     }
-    double duty_ref[9] = {1900, 1800, 1700, 1600, 1500, 1400, 1300, 1200, 1100};
-    double wid_ref[9] =  {0.97, 1.41, 2.40, 3.65, 4.39, 5.00, 5.43, 5.84, 5.96};
-    double len_ref[9] =  {5.84, 5.76, 5.54, 5.19, 4.80, 4.38, 3.87, 3.35, 3.01};
 
-    int duty = 0;
-    for(int i = 0; i < 9 - 1; i++) {
-        if(wid_ref[i] < width && width <= wid_ref[i +1]) {
-            servo_handler.cripper_len = len_ref[i] + (width - wid_ref[i])*( len_ref[i+1] - len_ref[i])
-                                        /(wid_ref[i+1] - wid_ref[i]);
-            duty = (int) (duty_ref[i] + (width - wid_ref[i])*( duty_ref[i+1] - duty_ref[i])/(wid_ref[i+1] - wid_ref[i]));
-            break;
+    esp_err_t err;
+    if (kind == ROBOT_IK_POSITION_ANGLE) {
+        err = _robot_ik_position_angle(x, y, z, angle, cripper_len, duty);
+    } else {
+        err = _robot_ik_position(x, y, z, cripper_len, from, duty);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    ik_cache_insert(ik_cache_handle, &key, duty);
+    return ESP_OK;
+}
+
+// solve a target into a duty vector from a snapshot, servo_lock is not needed
+// channels the target does not drive keep their duty_target, cripper_len is updated for width targets
+static esp_err_t _robot_target_solve(const robot_target_t *target, const robot_snapshot_t *snapshot, bool use_cache,
+                                     int *duty, double *cripper_len)
+{
+    memcpy(duty, snapshot->duty_target, sizeof(snapshot->duty_target));
+    *cripper_len = snapshot->cripper_len;
+    double width = 0;
+    if (target->kind == ROBOT_TARGET_WIDTH_POSITION || target->kind == ROBOT_TARGET_POSITION_ANGLE_WIDTH) {
+        width = target->width;
+        if (gripper_model_lookup(gripper_model_handle, width, &duty[SERVO_CHANNEL_5], cripper_len) != ESP_OK) {
+            DLOG_F32(DLOG_TARGET_WIDTH, width);
+            return ESP_ERR_INVALID_ARG;
         }
+    } else if (target->kind != ROBOT_TARGET_POSITION && target->kind != ROBOT_TARGET_POSITION_ANGLE) {
+        DLOG_I32(DLOG_TARGET_KIND, target->kind);
+        return ESP_ERR_INVALID_ARG;
     }
-    return duty;
+    if (target->kind == ROBOT_TARGET_POSITION_ANGLE || target->kind == ROBOT_TARGET_POSITION_ANGLE_WIDTH) {
+        return _robot_ik_cached(ROBOT_IK_POSITION_ANGLE, target->x, target->y, target->z, target->angle, width,
+                                *cripper_len, snapshot->duty_current, use_cache, duty);
+    }
+    return _robot_ik_cached(ROBOT_IK_POSITION, target->x, target->y, target->z, 0, width, *cripper_len,
+                            snapshot->duty_current, use_cache, duty);
 }
 
-esp_err_t robot_set_cripper_width(double width)
+// solve a target and start moving to it, cripper length of a new width is committed together with the duty
+// it was solved for. servo_lock is only held to copy the start state and to load the lspb vectors, the
+// motion tick never waits for the ik search. targets are only set from the command task, so nothing moves
+// duty_target between the snapshot and the apply
+static esp_err_t _robot_target_apply(const robot_target_t *target)
 {
-    const char *TAG = "file: servo_control.c , function: robot_set_cripper_width";
-    int duty = _width2duty(width);
-    if (duty == 0) {
-        ESP_LOGE(TAG, "Invalid argument");
+    ROBOT_STATS_BEGIN(stamp);
+    int duty[SERVO_MAX_CHANNEL];
+    double cripper_len;
+    robot_snapshot_t snapshot;
+    mutex_lock(servo_lock);
+    _robot_snapshot(&snapshot);
+    mutex_unlock(servo_lock);
+    if (_robot_target_solve(target, &snapshot, true, duty, &cripper_len) != ESP_OK) {
+        ROBOT_STATS_END(ROBOT_STATS_SET_POS + target->kind, stamp);
         return ESP_ERR_INVALID_ARG;
     }
+
+    // set duty to run servo, cripper channel only moves for width targets
+    // i = SERVO_CHANNEL_[I]
+    int channel_num = SERVO_MAX_CHANNEL - 1;
+    if (target->kind == ROBOT_TARGET_WIDTH_POSITION || target->kind == ROBOT_TARGET_POSITION_ANGLE_WIDTH) {
+        channel_num = SERVO_MAX_CHANNEL;
+    }
     mutex_lock(servo_lock);
-    servo_duty_set_lspb_calc(duty, SERVO_CHANNEL_5);
-    ESP_LOGI(TAG, "width set: %.1lf", width);
+    esp_err_t err = _robot_plan_channels(duty, channel_num);
+    if (err != ESP_OK) {
+        mutex_unlock(servo_lock);
+        ROBOT_STATS_END(ROBOT_STATS_SET_POS + target->kind, stamp);
+        return err;
+    }
+    // before the publish, the trajectory carries it to the journal
+    servo_handler.cripper_len = cripper_len;
+    _robot_plan_publish();
     mutex_unlock(servo_lock);
+    ROBOT_STATS_END(ROBOT_STATS_SET_POS + target->kind, stamp);
     return ESP_OK;
 }
 
-// preprocess to put x y z position
-// function return pointer of xyzther3 array
-esp_err_t robot_set_width_position(double width, double x, double y, double z)
+// dry run of the ik and limit checks for num targets, servo_handler and the ik cache are not touched
+esp_err_t robot_validate(const robot_target_t *target, int num, robot_validate_result_t *result)
 {
-    const char *TAG = "file: servo_control.c , function: robot_set_width_with_position";
-    int duty[6];
-    duty[5] = _width2duty(width);
-    if (duty == 0) {
-        ESP_LOGE(TAG, "Invalid argument");
-        return ESP_ERR_INVALID_ARG;
-    }
-    ESP_LOGI(TAG, "width set: %.1lf", width);
-    // static double a = 1.0, d = 0.0, d1 = 8.7, a2 = 10.5, a3 = 10.0, d5 = 20.5;
-    ESP_LOGI(TAG, "position set: x: %.2lf, y: %.2lf, z: %.2lf", x, y, z);
+    robot_snapshot_t snapshot;
     mutex_lock(servo_lock);
-    z = z - 8.7;
-    y = y + 7.94;
-    double theta[5];
-    double a1 = 0.915 ; // O0 to O1
+    _robot_snapshot(&snapshot);
+    mutex_unlock(servo_lock);
+    for (int n = 0; n < num; n++) {
+        double cripper_len;
+        memset(&result[n], 0, sizeof(robot_validate_result_t));
+        if (_robot_target_solve(&target[n], &snapshot, false, result[n].duty, &cripper_len) != ESP_OK) {
+            continue;
+        }
+        result[n].reachable = true;
+        result[n].cripper_len = cripper_len;
+        // lspb planner moves every channel in time_full whatever the distance is
+        for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+            if (result[n].duty[i] != snapshot.duty_current[i]) {
+                result[n].duration = snapshot.time_full;
+                break;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+// inverse of _robot_ik_position_branch / _robot_ik_position_angle with the current calibration
+// both leave the links at absolute angles theta[1], theta[1] + theta[2], theta[1] + theta[2] + theta[3]
+esp_err_t robot_forward(const int *duty, double cripper_len, double *x, double *y, double *z)
+{
+    const char *TAG = "file: servo_control.c , function: robot_forward";
+    double a1 = 0.915;     // O0 to O1
     double a2 = 10.225, a3 = 9.7;
-    double a4 = 14.6 + servo_handler.cripper_len;
-    double d = sqrt(x * x + y * y) - a1;     // z = 0;
+    double a4 = 14.6 + cripper_len;
+    double theta[4];
+    for (int i = 0; i < 4; i++) {
+        servo_channel_calib_t calib = servo_handler.duty_calib[i];
+        if (calib.upper_limit <= calib.under_limit) {
+            ESP_LOGE(TAG, "channel %d is not calibrated", i);
+            return ESP_ERR_INVALID_STATE;
+        }
+        theta[i] = (duty[i] - calib.under_limit) / (calib.upper_limit - calib.under_limit) * 90.0;
+    }
+    // undo _math_scale
+    theta[0] = theta[0] + 45;
+    theta[1] = 90 - theta[1];
+    theta[2] = theta[2] - 90;
+    theta[3] = theta[3] - 135;
+    double link3 = theta[1] + theta[2];
+    double link4 = link3 + theta[3];
+    double d = a2 * cosd(theta[1]) + a3 * cosd(link3) + a4 * cosd(link4) + a1;
+    double h = a2 * sind(theta[1]) + a3 * sind(link3) + a4 * sind(link4);
+    *x = d * cosd(theta[0]);
+    *y = d * sind(theta[0]) - 7.94;
+    *z = h + 8.7;
+    return ESP_OK;
+}
 
-    theta[0] = atan2d(y, x);     // + atan2d(d, r);
-    theta[1] = 90;
-    while (_math_in_workspace(d, z, theta[1], a2, a3, a4) == false) {
-        theta[1]--;
-        if (theta[1] == 0) {
-            ESP_LOGE(TAG, "position is out of workspace");
-            mutex_unlock(servo_lock);
+esp_err_t robot_set_ik_select(const robot_ik_select_t *select)
+{
+    const char *TAG = "file: servo_control.c , function: robot_set_ik_select";
+    if (select->mode < ROBOT_IK_SELECT_FIRST || select->mode > ROBOT_IK_SELECT_MIN_TIME) {
+        ESP_LOGE(TAG, "ik select mode %d is not available", select->mode);
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
+        if (select->weight[i] < 0 || select->speed[i] <= 0) {
+            ESP_LOGE(TAG, "channel %d weight: %.2lf, speed: %.2lf", i, select->weight[i], select->speed[i]);
             return ESP_ERR_INVALID_ARG;
         }
     }
+    mutex_lock(servo_lock);
+    ik_select = *select;
+    ik_cache_invalidate(ik_cache_handle);
+    mutex_unlock(servo_lock);
+    ESP_LOGI(TAG, "ik select mode: %d", select->mode);
+    return ESP_OK;
+}
 
-    double z2 = a2 * sind(theta[1]);
-    double d2 = a2 * cosd(theta[1]);
-    double r24 = sqrt((z - z2) * (z - z2) + (d - d2) * (d - d2));
-    double c4 = (r24 * r24 - a3 * a3 - a4 * a4) / (2 * a3 * a4);
-    double s4 = sqrt(1 - c4 * c4);
-    // theta[3] < 0 => clockwise, -135 => -45
-    theta[3] = atan2d(-s4, c4);
-    // theta[2] < 0 => clockwise
-    double phi = acosd((r24 * r24 + a3 * a3 - a4 * a4) / (2 * r24 * a3));     // 0 => 180
-    double alpha = atan2d(z - z2, d - d2);                                    // -90 => 90
-    theta[2] = -(theta[1] - phi - alpha);                                     // => theta[2]: -90 => 180
-    // theta[4]
-    theta[4] = 45;
+esp_err_t robot_get_ik_select(robot_ik_select_t *select)
+{
+    mutex_lock(servo_lock);
+    *select = ik_select;
+    mutex_unlock(servo_lock);
+    return ESP_OK;
+}
 
-    // convert arguments
-    ESP_LOGI(TAG, "theta:  theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
-    theta[0] = _math_scale(theta[0], 1, -45, 0, 90);     // real [1000:2000] us = [45:135] => 0: 90
-    theta[1] = _math_scale(theta[1], -1, 90, 0, 90);     // real [1000:2000] us = [90:0]   => 0: 90
-    theta[2] = _math_scale(theta[2], 1, 90, 0, 90);      // real [1000:2000] us = [-90:0]  => 0: 90
-    theta[3] = _math_scale(theta[3], 1, 135, 0, 90);     // real [1000:2000] us = [-135:-45] => 0: 90
-    theta[4] = _math_scale(theta[4], 1, 0, 0, 90);       // real [1000:2000] us = [0:90] => 0: 90
-    ESP_LOGD(TAG, "scale off: theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
+esp_err_t robot_get_ik_cache_stats(ik_cache_stats_t *stats)
+{
+    return ik_cache_get_stats(ik_cache_handle, stats);
+}
 
-    for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
-        if (theta[i] == -1) {
-            ESP_LOGE(TAG, "theta [%d] == -1", i);
-            mutex_unlock(servo_lock);
-            return ESP_ERR_INVALID_ARG;
-        }
-        duty[i] = _math_deg2duty(theta[i], servo_handler.duty_calib[i]);
+// preprocess to put x y z position
+// function return pointer of xyzther3 array
+esp_err_t robot_set_position(double x, double y, double z)
+{
+    DLOG_F32(DLOG_SET_POSITION, x, y, z);
+    robot_target_t target = {
+        .kind = ROBOT_TARGET_POSITION,
+        .x = x,
+        .y = y,
+        .z = z,
+    };
+    return _robot_target_apply(&target);
+}
+
+esp_err_t robot_set_position_with_angle(double x, double y, double z, double angle)
+{
+    DLOG_F32(DLOG_SET_POSITION_ANGLE, x, y, z, angle);
+    robot_target_t target = {
+        .kind = ROBOT_TARGET_POSITION_ANGLE,
+        .x = x,
+        .y = y,
+        .z = z,
+        .angle = angle,
+    };
+    return _robot_target_apply(&target);
+}
+
+esp_err_t robot_set_home()
+{
+    ROBOT_STATS_BEGIN(stamp);
+    int home[SERVO_MAX_CHANNEL] = SERVO_HOME_DUTY;     // the cripper is left where it is
+    mutex_lock(servo_lock);
+    esp_err_t err = _robot_plan_channels(home, SERVO_MAX_CHANNEL - 1);
+    if (err == ESP_OK) {
+        _robot_plan_publish();
     }
-    ESP_LOGI(TAG, "duty : duty[0]: %d, duty[1]: %d, duty[2]: %d, duty[3]: %d, duty[4]: %d", duty[0],
-             duty[1], duty[2], duty[3], duty[4]);
+    mutex_unlock(servo_lock);
+    ROBOT_STATS_END(ROBOT_STATS_SET_HOME, stamp);
+    return err;
+}
 
-    // set duty to run servo
-    // i = SERVO_CHANNEL_[I]
+// read the duty_target vector and cripper length, used to teach a pose
+esp_err_t robot_get_pose(int *duty, double *cripper_len)
+{
+    mutex_lock(servo_lock);
     for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
-        servo_duty_set_lspb_calc(duty[i], i);
+        duty[i] = plan.duty_target[i];
     }
+    *cripper_len = servo_handler.cripper_len;
     mutex_unlock(servo_lock);
     return ESP_OK;
 }
 
-esp_err_t robot_set_position_angle_width(double x, double y, double z, double angle, double width)
+// replay a taught duty vector directly, no ik
+esp_err_t robot_set_pose(const int *duty, double cripper_len)
 {
-    const char *TAG = __func__;     //__func__
-    int duty[6];
-    duty[5] = _width2duty(width);
-    if (duty == 0) {
-        ESP_LOGE(TAG, "Invalid argument");
-        return ESP_ERR_INVALID_ARG;
+    const char *TAG = "file: servo_control.c , function: robot_set_pose";
+    ROBOT_STATS_BEGIN(stamp);
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        if (duty[i] < SERVO_MIN_PULSEWIDTH || duty[i] > SERVO_MAX_PULSEWIDTH) {
+            ESP_LOGE(TAG, "duty[%d]: %d out of range", i, duty[i]);
+            ROBOT_STATS_END(ROBOT_STATS_SET_POSE, stamp);
+            return ESP_ERR_INVALID_ARG;
+        }
     }
-    ESP_LOGI(TAG, "width set: %.1lf", width);
-    ESP_LOGI(TAG, "position set: x: %.2lf, y: %.2lf, z: %.2lf / angle set: %.2lf", x, y, z, angle);
     mutex_lock(servo_lock);
-    z = z - 8.7;
-    y = y + 7.94;
-    double theta[5];
-    double a1 = 0.915;     // O0 to O1
-    double a2 = 10.225, a3 = 9.7;
-    double a4 = 14.6 + servo_handler.cripper_len;
-
-    double d = sqrt(x * x + y * y) - a1;     // z = 0;
-    theta[0] = atan2d(y, x);
-    // theta[1]
-    double z_ = z + a4;
-    double a23 = sqrt( z_*z_ + d*d );
-    if( a23 > a2 + a3) {
-        ESP_LOGE(TAG, "a23 > a2 + a3 ");
-        mutex_unlock(servo_lock);
-        return ESP_ERR_INVALID_ARG;
+    esp_err_t err = _robot_plan_channels(duty, SERVO_MAX_CHANNEL);
+    if (err == ESP_OK) {
+        // before the publish, the trajectory carries it to the journal
+        servo_handler.cripper_len = cripper_len;
+        _robot_plan_publish();
     }
+    mutex_unlock(servo_lock);
+    ROBOT_STATS_END(ROBOT_STATS_SET_POSE, stamp);
+    return err;
+}
 
-    double alpha = atan2d(d, z_);
-    double phi = acosd( (a2*a2 + a23*a23 - a3*a3) / (2*a2*a23));
-    theta[1] = 90 - (alpha - phi);
+/*
+ *
+ ************************************* CRIPPER WIDTH WITH PULSE *********************************************
+ *
+ */
+// width -> duty and width -> length come from the calibrated gripper model (gripper_model.c)
 
-    // theta[2]
-    double beta = acosd( (a2*a2 + a3*a3 - a23*a23) / (2*a2*a3));
-    if( beta < 90) {
-        ESP_LOGE(TAG, "beta %lf  < 90", beta);
-        mutex_unlock(servo_lock);
+esp_err_t robot_set_cripper_width(double width)
+{
+    const char *TAG = "file: servo_control.c , function: robot_set_cripper_width";
+    ROBOT_STATS_BEGIN(stamp);
+    int duty;
+    double cripper_len;
+    if (gripper_model_lookup(gripper_model_handle, width, &duty, &cripper_len) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid argument");
+        ROBOT_STATS_END(ROBOT_STATS_SET_WID, stamp);
         return ESP_ERR_INVALID_ARG;
     }
-    theta[2] = -(180.0 - beta);        // theta[2] [0:90]
+    mutex_lock(servo_lock);
+    esp_err_t err = _robot_plan_channel(duty, SERVO_CHANNEL_5);
+    if (err == ESP_OK) {
+        // before the publish, the trajectory carries it to the journal
+        servo_handler.cripper_len = cripper_len;
+        _robot_plan_publish();
+    }
+    mutex_unlock(servo_lock);
+    ROBOT_STATS_END(ROBOT_STATS_SET_WID, stamp);
+    DLOG_F32(DLOG_SET_WIDTH, width);
+    return err;
+}
 
-    // theta[3]
-    theta[3] = - (beta + phi - alpha);
-    // theta[4]
-    theta[4] = angle;
+// preprocess to put x y z position
+// function return pointer of xyzther3 array
+esp_err_t robot_set_width_position(double width, double x, double y, double z)
+{
+    DLOG_F32(DLOG_SET_WIDTH, width);
+    DLOG_F32(DLOG_SET_POSITION, x, y, z);
+    robot_target_t target = {
+        .kind = ROBOT_TARGET_WIDTH_POSITION,
+        .x = x,
+        .y = y,
+        .z = z,
+        .width = width,
+    };
+    return _robot_target_apply(&target);
+}
 
-    // convert arguments
-    ESP_LOGI(TAG, "theta:  theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
-    theta[0] = _math_scale(theta[0], 1, -45, 0, 90);     // real [1000:2000] us = [45:135] => 0: 90
-    theta[1] = _math_scale(theta[1], -1, 90, 0, 90);     // real [1000:2000] us = [90:0]   => 0: 90
-    theta[2] = _math_scale(theta[2], 1, 90, 0, 90);      // real [1000:2000] us = [-90:0]  => 0: 90
-    theta[3] = _math_scale(theta[3], 1, 135, 0, 90);     // real [1000:2000] us = [-135:-45] => 0: 90
-    theta[4] = _math_scale(theta[4], 1, 0, 0, 90);       // real [1000:2000] us = [0:90] => 0: 90
-    ESP_LOGD(TAG, "scale off: theta[0]: %.2lf, theta[1]: %.2lf, theta[2]: %.2lf, theta[3]: %.2lf, theta[4]: %.2lf",
-             theta[0], theta[1], theta[2], theta[3], theta[4]);
-    // convert to duty
-    for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
-        if (theta[i] == -1) {
-            ESP_LOGE(TAG, "theta [%d] == -1", i);
-            mutex_unlock(servo_lock);
-            return ESP_ERR_INVALID_ARG;
-        }
-        duty[i] = _math_deg2duty(theta[i], servo_handler.duty_calib[i]);
-    }
-    ESP_LOGI(TAG, "duty : duty[0]: %d, duty[1]: %d, duty[2]: %d, duty[3]: %d, duty[4]: %d", duty[0],
-             duty[1], duty[2], duty[3], duty[4]);
+esp_err_t robot_set_position_angle_width(double x, double y, double z, double angle, double width)
+{
+    DLOG_F32(DLOG_SET_WIDTH, width);
+    DLOG_F32(DLOG_SET_POSITION_ANGLE, x, y, z, angle);
+    robot_target_t target = {
+        .kind = ROBOT_TARGET_POSITION_ANGLE_WIDTH,
+        .x = x,
+        .y = y,
+        .z = z,
+        .angle = angle,
+        .width = width,
+    };
+    return _robot_target_apply(&target);
+}
 
-    // set duty to run servo
-    // i = SERVO_CHANNEL_[I]
-    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
-        servo_duty_set_lspb_calc(duty[i], i);
+// stage one gripper calibration point, see gripper_model_set_point
+esp_err_t robot_set_gripper_point(int idx, double width, int duty, double len)
+{
+    gripper_model_point_t point = {
+        .width = width,
+        .duty = duty,
+        .len = len,
+    };
+    return gripper_model_set_point(gripper_model_handle, idx, &point);
+}
+
+// rebuild and persist gripper model from num staged points, num = 0 => factory table
+esp_err_t robot_save_gripper_model(int num)
+{
+    esp_err_t err = gripper_model_commit(gripper_model_handle, num);
+    if (err != ESP_OK) {
+        return err;
     }
-    // set time to zero
-    mutex_unlock(servo_lock);
+    // cached width paths hold the cripper duty of the old model
+    ik_cache_invalidate(ik_cache_handle);
     return ESP_OK;
 }
 
@@ -1027,16 +1554,83 @@ esp_err_t robot_set_position_angle_width(double x, double y, double z, double an
  *
  */
 static const char *SERVO_NVS = "servo_nvs";
+static const char *GRIPPER_NVS = "gripper_model";
+static uint32_t _servo_nvs_crc(const servo_nvs_record_t *record)
+{
+    return crc32_le(0, (const uint8_t *)record, offsetof(servo_nvs_record_t, crc));
+}
+
+// stage the persistent parameters and ask the motion task to save them at rest, must be called with servo_lock
+static void _servo_nvs_stage(void)
+{
+    servo_nvs_record_t record;
+    memset(&record, 0, sizeof(record));     // padding is covered by the crc
+    record.magic = SERVO_NVS_MAGIC;
+    record.version = SERVO_NVS_VERSION;
+    record.size = sizeof(servo_nvs_record_t);
+    memcpy(record.duty_calib, servo_handler.duty_calib, sizeof(record.duty_calib));
+    record.time_full = servo_handler.time_full;
+    record.time_balance = servo_handler.time_balance;
+    record.crc = _servo_nvs_crc(&record);
+    portENTER_CRITICAL(&servo_nvs_mux);
+    servo_nvs_record = record;
+    servo_nvs_dirty = true;
+    servo_nvs_stage_seq++;
+    portEXIT_CRITICAL(&servo_nvs_mux);
+    if (event_queue) {
+        servo_event_t event = {.type = EVENT_NVS_SAVE};
+        xQueueSend(event_queue, &event, 0);
+    }
+}
+
 // pack and unpack funtion
 static int _pack_func(void *context, char *buffer, int max_buffer_size)
 {
-    memcpy(buffer, &servo_handler, sizeof(servo_handle_t));
-    return sizeof(servo_handle_t);
+    if (max_buffer_size < sizeof(servo_nvs_record_t)) {
+        return 0;
+    }
+    portENTER_CRITICAL(&servo_nvs_mux);
+    memcpy(buffer, &servo_nvs_record, sizeof(servo_nvs_record_t));
+    servo_nvs_packed_seq = servo_nvs_stage_seq;
+    portEXIT_CRITICAL(&servo_nvs_mux);
+    return sizeof(servo_nvs_record_t);
+}
+
+// STORAGE-TASK, dirty is only cleared once the last staged record is on flash. A failed write leaves it set
+// and the next save event snapshots the record again
+static void _written_func(void *context, esp_err_t err)
+{
+    portENTER_CRITICAL(&servo_nvs_mux);
+    if (err != ESP_OK) {
+        servo_nvs_dirty = true;
+    } else if (servo_nvs_packed_seq == servo_nvs_stage_seq) {
+        servo_nvs_dirty = false;
+    }
+    portEXIT_CRITICAL(&servo_nvs_mux);
 }
 
 static esp_err_t _unpack_func(void *context, char *buffer, int loaded_len)
 {
-    memcpy(&servo_handler, buffer, loaded_len);
+    const char *TAG = "file: servo_control.c , function: _unpack_func";
+    servo_nvs_record_t record;
+    if (loaded_len != sizeof(servo_nvs_record_t)) {
+        ESP_LOGW(TAG, "record len %d != %d", loaded_len, (int)sizeof(servo_nvs_record_t));
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&record, buffer, sizeof(servo_nvs_record_t));
+    if (record.magic != SERVO_NVS_MAGIC || record.version != SERVO_NVS_VERSION ||
+        record.size != sizeof(servo_nvs_record_t)) {
+        ESP_LOGW(TAG, "magic: %x, version: %d, size: %d", record.magic, record.version, record.size);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (record.crc != _servo_nvs_crc(&record)) {
+        ESP_LOGW(TAG, "crc error");
+        return ESP_ERR_INVALID_CRC;
+    }
+    memcpy(servo_handler.duty_calib, record.duty_calib, sizeof(record.duty_calib));
+    servo_handler.time_full = record.time_full;
+    servo_handler.time_balance = record.time_balance;
+    servo_nvs_record = record;
     return ESP_OK;
 }
 
@@ -1046,31 +1640,40 @@ esp_err_t servo_nvs_load(void)
 {
     const char *TAG = "file: servo_control.c , function: servo_nvs_load";
     ESP_LOGI(TAG, "Flash init ...");
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        err = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(err);
-
+    robot_boot_begin(ROBOT_BOOT_NVS_INIT);
+    // a full store is erased, NVS_ERASE is stamped by the hal
+    ESP_ERROR_CHECK(robot_hal_kv_init());
+    robot_boot_end(ROBOT_BOOT_NVS_INIT);
+
+    // ends in app_main once the pose table is loaded too
+    robot_boot_begin(ROBOT_BOOT_STORAGE);
+    // saves only snapshot, STORAGE-TASK writes flash below every robot task on the command core
     esp_storage_config_t storage_cfg = {
         .namespace = "servo_param",
         .buffer_size = 1024,
+        .write_behind = true,
+        .task_priority = 1,
+        .task_core = ROBOT_COMM_TASK_CORE,
+        .coalesce_ms = 200,
     };
     storage_handle = esp_storage_init(&storage_cfg);
     esp_storage_add(storage_handle, SERVO_NVS, _unpack_func, _pack_func, NULL);
+    esp_storage_set_written(storage_handle, SERVO_NVS, _written_func);
 
+    gripper_model_config_t gripper_cfg = {
+        .storage = storage_handle,
+        .key = GRIPPER_NVS,
+        .lut_size = GRIPPER_MODEL_LUT_SIZE,
+    };
+    gripper_model_handle = gripper_model_init(&gripper_cfg);
+
+    _servo_param_set_default(&servo_handler);
     if (esp_storage_load(storage_handle, SERVO_NVS) != ESP_OK) {
         ESP_LOGW(TAG, "load flash fail, set param default");
-        _servo_param_set_default(&servo_handler);
-        return esp_storage_save(storage_handle, SERVO_NVS);
-    }
-
-    if (servo_handler.nvs_magic != SERVO_NVS_MAGIC) {
-        ESP_LOGW(TAG, "magic = %x", servo_handler.nvs_magic);
-        _servo_param_set_default(&servo_handler);
+        _servo_nvs_stage();
         return esp_storage_save(storage_handle, SERVO_NVS);
     }
+    ik_cache_invalidate(ik_cache_handle);
     for (int i = 0; i < SERVO_MAX_CHANNEL - 1; i++) {
         ESP_LOGI(TAG, "servo limit: channel[%d].upper_limit: %lf", i, servo_handler.duty_calib[i].upper_limit);
         ESP_LOGI(TAG, "servo limit: channel[%d].under_limit: %lf", i, servo_handler.duty_calib[i].under_limit);
@@ -1078,12 +1681,19 @@ esp_err_t servo_nvs_load(void)
     return ESP_OK;
 }
 
+esp_storage_handle_t servo_nvs_get_storage(void) { return storage_handle; }
+
 // save param after timeout second
 esp_err_t _servo_nvs_save_all(void)
 {
     const char *TAG = "file: servo_control.c , function: _servo_nvs_save_all";
     if (storage_handle) {
-        esp_storage_save(storage_handle, SERVO_NVS);
+        esp_err_t err = esp_storage_save(storage_handle, SERVO_NVS);
+        if (err != ESP_OK) {
+            // dirty is still set, retried on the next save event
+            ESP_LOGE(TAG, "save error: %d", err);
+            return err;
+        }
         ESP_LOGI(TAG, "saved ok");
         return ESP_OK;
     }
@@ -1094,30 +1704,52 @@ esp_err_t _servo_nvs_save_all(void)
 esp_err_t servo_nvs_save(bool option, int channel)
 {
     const char *TAG = "file: servo_control.c , function: servo_nvs_save";
+    mutex_lock(servo_lock);
+    int duty_target = plan.duty_target[channel];
     if (option == OPTION_UPPER_LIMIT) {
-        servo_handler.duty_calib[channel].upper_limit = (double)servo_handler.channel[channel].duty_target;
-        ESP_LOGI(TAG, "upper limit channel[%d] change: %d", channel, servo_handler.channel[channel].duty_target);
+        servo_handler.duty_calib[channel].upper_limit = (double)duty_target;
     } else if (option == OPTION_UNDER_LIMIT) {
-        servo_handler.duty_calib[channel].under_limit = (double)servo_handler.channel[channel].duty_target;
-        ESP_LOGI(TAG, "under limit channel[%d] change: %d", channel, servo_handler.channel[channel].duty_target);
-    }
-    if (storage_handle) {
-        esp_storage_save(storage_handle, SERVO_NVS);
-        ESP_LOGI(TAG, "saved ok");
+        servo_handler.duty_calib[channel].under_limit = (double)duty_target;
     }
+    _servo_nvs_stage();
+    mutex_unlock(servo_lock);
+    ESP_LOGI(TAG, "%s limit channel[%d] change: %d", option == OPTION_UPPER_LIMIT ? "upper" : "under", channel,
+             duty_target);
+    ik_cache_invalidate(ik_cache_handle);
     return ESP_OK;
 }
 
 esp_err_t servo_nvs_default(void)
 {
-    _servo_param_set_default(&servo_handler);
-    _servo_nvs_save_all();
+    // channel state belongs to the motion task, the arm is sent home through the plan instead
+    servo_handle_t defaults;
+    _servo_param_set_default(&defaults);
+    int duty[SERVO_MAX_CHANNEL];
+    for (int i = 0; i < SERVO_MAX_CHANNEL; i++) {
+        duty[i] = defaults.channel[i].duty_target;
+    }
+    mutex_lock(servo_lock);
+    // the home pose is planned first, a rejected one leaves the parameters as they are
+    esp_err_t err = _robot_plan_channels(duty, SERVO_MAX_CHANNEL);
+    if (err != ESP_OK) {
+        mutex_unlock(servo_lock);
+        return err;
+    }
+    memcpy(servo_handler.duty_calib, defaults.duty_calib, sizeof(defaults.duty_calib));
+    servo_handler.time_full = defaults.time_full;
+    servo_handler.time_balance = defaults.time_balance;
+    servo_handler.cripper_len = defaults.cripper_len;
+    _servo_nvs_stage();
+    _robot_plan_publish();
+    mutex_unlock(servo_lock);
+    ik_cache_invalidate(ik_cache_handle);
     return ESP_OK;
 }
 
 esp_err_t servo_nvs_restore(bool option, int channel)
 {
     const char *TAG = "file: servo_control.c , function: servo_nvs_save";
+    mutex_lock(servo_lock);
     if (option == OPTION_UPPER_LIMIT) {
         servo_handler.duty_calib[channel].upper_limit = DEFAULT_UPPER_LIMIT;
         ESP_LOGI(TAG, "upper limit channel[%d] change: %d", channel, DEFAULT_UPPER_LIMIT);
@@ -1125,10 +1757,9 @@ esp_err_t servo_nvs_restore(bool option, int channel)
         servo_handler.duty_calib[channel].under_limit = DEFAULT_UNDER_LIMIT;
         ESP_LOGI(TAG, "under limit channel[%d] change: %d", channel, DEFAULT_UNDER_LIMIT);
     }
-    if (storage_handle) {
-        esp_storage_save(storage_handle, SERVO_NVS);
-        ESP_LOGI(TAG, "saved ok");
-    }
+    _servo_nvs_stage();
+    mutex_unlock(servo_lock);
+    ik_cache_invalidate(ik_cache_handle);
     return ESP_OK;
 }
 /*
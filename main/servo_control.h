@@ -10,20 +10,14 @@
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 
-#include "nvs.h"
-#include "nvs_flash.h"
-
-#include "driver/mcpwm.h"
-#include "soc/mcpwm_periph.h"
-
-#include "driver/gpio.h"
-#include "driver/timer.h"
-#include "driver/uart.h"
-
 #include "esp_attr.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_storage.h"
+#include "gripper_model.h"
+#include "ik_cache.h"
+#include "robot_config.h"
 
 #define OPTION_UPPER_LIMIT (1)
 #define OPTION_UNDER_LIMIT (0)
@@ -34,6 +28,61 @@ typedef enum {
     SERVO_STATUS_RUNNING,
 } servo_status_t;
 
+// lspb segment a channel is in, reported by _math_path_planning for the trace recorder
+typedef enum {
+    SERVO_LSPB_PHASE_IDLE = 0,
+    SERVO_LSPB_PHASE_ACCEL,
+    SERVO_LSPB_PHASE_CRUISE,
+    SERVO_LSPB_PHASE_DECEL,
+    SERVO_LSPB_PHASE_DONE,
+} servo_lspb_phase_t;
+
+// how the position ik picks theta[1] / elbow among the feasible solutions
+typedef enum {
+    ROBOT_IK_SELECT_FIRST = 0,         // legacy, first theta[1] inside workspace from 90 degree down, elbow down
+    ROBOT_IK_SELECT_MIN_DISTANCE,      // min sum of weight[i] * |duty[i] - duty_current[i]|
+    ROBOT_IK_SELECT_MIN_TIME,          // min of max |duty[i] - duty_current[i]| / speed[i]
+} robot_ik_select_mode_t;
+
+typedef struct {
+    robot_ik_select_mode_t mode;
+    double weight[5];     // cost per us of each joint
+    double speed[5];      // us per ms each joint can move
+} robot_ik_select_t;
+
+// the four robot_set_* ik paths as data, used for dry run validation
+typedef enum {
+    ROBOT_TARGET_POSITION = 0,             // robot_set_position
+    ROBOT_TARGET_POSITION_ANGLE,           // robot_set_position_with_angle
+    ROBOT_TARGET_WIDTH_POSITION,           // robot_set_width_position
+    ROBOT_TARGET_POSITION_ANGLE_WIDTH,     // robot_set_position_angle_width
+} robot_target_kind_t;
+
+typedef struct {
+    robot_target_kind_t kind;
+    double x;
+    double y;
+    double z;
+    double angle;
+    double width;
+} robot_target_t;
+
+// tick deadline monitor, see CONFIG_ROBOT_TICK_POLICY_* for what happens to a late tick
+typedef struct {
+    uint32_t tick;              // timer ticks received
+    uint32_t late;              // processed more than ROBOT_TICK_LATE_US after the isr
+    uint32_t missed;            // lost on a full event queue
+    uint32_t dropped;           // stale ticks skipped by the drop policy
+    uint32_t worst_late_us;
+} robot_tick_stats_t;
+
+typedef struct {
+    bool reachable;
+    int duty[6];        // duty vector the target would be driven with
+    int duration;       // ms, estimated move time from the current pose
+    double cripper_len;     // cm, last link length the duty was solved with
+} robot_validate_result_t;
+
 void servo_init(void);
 
 esp_err_t robot_set_position(double x, double y, double z);
@@ -44,8 +93,27 @@ esp_err_t servo_duty_set_lspb_calc(int duty, int channel);
 esp_err_t robot_set_home();
 esp_err_t robot_set_width_position(double width, double x, double y, double z);
 esp_err_t robot_set_position_angle_width(double x, double y, double z, double angle, double width);
+esp_err_t robot_get_pose(int *duty, double *cripper_len);
+esp_err_t robot_validate(const robot_target_t *target, int num, robot_validate_result_t *result);
+// tool tip position (cm, same frame as robot_set_position) the duty vector drives the arm to
+esp_err_t robot_forward(const int *duty, double cripper_len, double *x, double *y, double *z);
+esp_err_t robot_set_ik_select(const robot_ik_select_t *select);
+esp_err_t robot_set_gripper_point(int idx, double width, int duty, double len);
+esp_err_t robot_save_gripper_model(int num);
+esp_err_t robot_get_ik_select(robot_ik_select_t *select);
+esp_err_t robot_set_pose(const int *duty, double cripper_len);
 
 servo_status_t robot_get_status();
+// id of the command the next trajectories belong to, carried to the motion task for latency stamps
+void robot_set_command_id(int id_command);
+// block until the last published trajectory ends, ESP_FAIL on a servo error, ESP_ERR_TIMEOUT after timeout_ms
+// matched on the trajectory sequence, a reused command id never ends the wait early
+esp_err_t robot_wait_done(uint32_t timeout_ms);
+
+// hit and miss counters of the ik result cache
+esp_err_t robot_get_ik_cache_stats(ik_cache_stats_t *stats);
+esp_err_t robot_get_tick_stats(robot_tick_stats_t *stats);
+void robot_reset_tick_stats(void);
 
 // UART
 int msg_unpack(char *pkg, int pkg_len);
@@ -57,5 +125,6 @@ esp_err_t servo_nvs_load(void);
 esp_err_t servo_nvs_save(bool option, int channel);
 esp_err_t servo_nvs_restore(bool option, int channel);
 esp_err_t servo_nvs_default(void);
+esp_storage_handle_t servo_nvs_get_storage(void);
 
 #endif
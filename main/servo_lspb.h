@@ -0,0 +1,65 @@
+/*
+ * This file is subject to the terms of the Nanochip License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *                             ./LICENSE
+ */
+
+#ifndef _SERVO_LSPB_H_
+#define _SERVO_LSPB_H_
+
+#include "robot_config.h"
+#include "servo_control.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per channel lspb planner of the motion tick, tf and tb count ticks of ROBOT_TICK_MS.
+ * Only servo_control.c and the host planner tests use it
+ */
+
+typedef struct {
+    robot_real_t a;
+    robot_real_t P0;
+    robot_real_t Pf;
+    int tf;
+    int tb;
+} math_lspb_vector_t;
+
+typedef struct {
+    int duty_current;     // duty current
+    int duty_target;      // duty target
+    math_lspb_vector_t lspb;
+    servo_status_t status;
+    int time_count;
+} servo_channel_ctrl_t;
+
+/**
+ * Plan a move of time_full ms with time_balance ms blends from current_duty to target_duty
+ */
+void _math_lspb_vector_calc(int current_duty, int target_duty, int time_full, int time_balance,
+                            math_lspb_vector_t *lspb_vector);
+
+/**
+ * Duty of step *time_count of the plan, then advance *time_count. Pf once the plan is over
+ */
+int _math_path_planning(robot_real_t a, robot_real_t P0, robot_real_t Pf, int *time_count, int tf, int tb,
+                        servo_lspb_phase_t *phase);
+
+/**
+ * Replan the channel from its duty_current to duty_target, what the tick adopting a trajectory does per channel
+ */
+void _servo_channel_adopt(servo_channel_ctrl_t *servo_channel, int duty_target, int time_full, int time_balance);
+
+/**
+ * Step the channel once, the next lspb duty clamped to the pulse limits. IDLE once duty_target is reached,
+ * ERROR on a channel without duty. channel only tags the deferred log
+ */
+servo_status_t _servo_channel_step(servo_channel_ctrl_t *servo_channel, int channel, servo_lspb_phase_t *phase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif